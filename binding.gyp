@@ -2,8 +2,9 @@
   "targets": [
     {
       "target_name": "pprof",
-      "sources": [ 
+      "sources": [
         "bindings/profiler.cc",
+        "bindings/profile-serializer.cc",
       ],
       "include_dirs": [ "<!(node -e \"require('nan')\")" ],
       # TODO(#62): The following line suppresses compliation warnings
@@ -0,0 +1,366 @@
+/**
+ * Copyright 2020 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "profile-serializer.h"
+
+#include <cstring>
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+#include "zlib.h"
+
+namespace pprof {
+namespace {
+
+// Field numbers from third_party/proto/profile.proto.
+enum ProfileField {
+  kProfileSampleType = 1,
+  kProfileSample = 2,
+  kProfileLocation = 4,
+  kProfileFunction = 5,
+  kProfileStringTable = 6,
+  kProfileTimeNanos = 9,
+  kProfileDurationNanos = 10,
+  kProfilePeriodType = 11,
+  kProfilePeriod = 12,
+};
+
+enum ValueTypeField { kValueTypeType = 1, kValueTypeUnit = 2 };
+
+enum SampleField { kSampleLocationId = 1, kSampleValue = 2 };
+
+enum LocationField { kLocationId = 1, kLocationLine = 4 };
+
+enum LineField { kLineFunctionId = 1, kLineLine = 2 };
+
+enum FunctionField {
+  kFunctionId = 1,
+  kFunctionName = 2,
+  kFunctionSystemName = 3,
+  kFunctionFilename = 4,
+};
+
+// Minimal protobuf wire-format writer for the subset of profile.proto used
+// by this addon: varint scalars, packed repeated integers, and
+// length-delimited submessages built in a caller-provided scratch buffer.
+class ProtoBuffer {
+ public:
+  void WriteVarint(uint64_t value) {
+    while (value >= 0x80) {
+      buf_.push_back(static_cast<char>(value | 0x80));
+      value >>= 7;
+    }
+    buf_.push_back(static_cast<char>(value));
+  }
+
+  void WriteInt64Field(int field, int64_t value) {
+    if (value == 0) return;
+    WriteVarint(field << 3);  // wire type 0, varint.
+    WriteVarint(static_cast<uint64_t>(value));
+  }
+
+  void WriteStringField(int field, const char* data, size_t size) {
+    WriteVarint((field << 3) | 2);  // wire type 2, length-delimited.
+    WriteVarint(size);
+    buf_.insert(buf_.end(), data, data + size);
+  }
+
+  void WriteMessageField(int field, const ProtoBuffer& message) {
+    WriteStringField(field, message.buf_.data(), message.buf_.size());
+  }
+
+  void WritePackedInt64Field(int field, const std::vector<int64_t>& values) {
+    ProtoBuffer packed;
+    for (int64_t value : values) {
+      packed.WriteVarint(static_cast<uint64_t>(value));
+    }
+    WriteMessageField(field, packed);
+  }
+
+  void Clear() { buf_.clear(); }
+
+  const std::vector<char>& data() const { return buf_; }
+
+ private:
+  std::vector<char> buf_;
+};
+
+// Accumulates the deduplicated string, function, and location tables while
+// walking a v8::CpuProfile, mirroring the dedup logic of serialize() in
+// ts/src/profile-serializer.ts.
+class TimeProfileEncoder {
+ public:
+  explicit TimeProfileEncoder(int64_t intervalMicros)
+      : intervalMicros_(intervalMicros) {
+    // First string table entry must be "".
+    StringId("");
+  }
+
+  // May be called repeatedly to merge several profiles before Encode():
+  // samples with identical stacks are summed, durations accumulate, and the
+  // reported collection time is the wall time of the first Add.
+  void Add(const v8::CpuProfile* profile) {
+    if (timeNanos_ == 0) {
+      timeNanos_ = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch())
+                       .count();
+    }
+    durationNanos_ += (profile->GetEndTime() - profile->GetStartTime()) * 1000;
+    std::vector<uint64_t> stack;
+    const v8::CpuProfileNode* root = profile->GetTopDownRoot();
+    // As in the JS serializer, the "(root)" node itself is not emitted.
+    for (int i = 0; i < root->GetChildrenCount(); i++) {
+      AddNode(root->GetChild(i), &stack);
+    }
+  }
+
+  std::vector<char> Encode() {
+    ProtoBuffer out;
+    ProtoBuffer scratch;
+
+    int64_t sampleType = StringId("sample");
+    int64_t countUnit = StringId("count");
+    int64_t wallType = StringId("wall");
+    int64_t microsecondsUnit = StringId("microseconds");
+
+    WriteValueType(&out, kProfileSampleType, sampleType, countUnit, &scratch);
+    WriteValueType(&out, kProfileSampleType, wallType, microsecondsUnit,
+                   &scratch);
+
+    for (const Sample& sample : samples_) {
+      scratch.Clear();
+      scratch.WritePackedInt64Field(
+          kSampleLocationId,
+          std::vector<int64_t>(sample.stack.begin(), sample.stack.end()));
+      std::vector<int64_t> values = {sample.hitCount,
+                                     sample.hitCount * intervalMicros_};
+      scratch.WritePackedInt64Field(kSampleValue, values);
+      out.WriteMessageField(kProfileSample, scratch);
+    }
+
+    for (const Location& location : locations_) {
+      ProtoBuffer line;
+      line.WriteInt64Field(kLineFunctionId, location.functionId);
+      line.WriteInt64Field(kLineLine, location.line);
+      scratch.Clear();
+      scratch.WriteInt64Field(kLocationId, location.id);
+      scratch.WriteMessageField(kLocationLine, line);
+      out.WriteMessageField(kProfileLocation, scratch);
+    }
+
+    for (const Function& function : functions_) {
+      scratch.Clear();
+      scratch.WriteInt64Field(kFunctionId, function.id);
+      scratch.WriteInt64Field(kFunctionName, function.name);
+      scratch.WriteInt64Field(kFunctionSystemName, function.name);
+      scratch.WriteInt64Field(kFunctionFilename, function.filename);
+      out.WriteMessageField(kProfileFunction, scratch);
+    }
+
+    for (const std::string& str : strings_) {
+      out.WriteStringField(kProfileStringTable, str.data(), str.size());
+    }
+
+    int64_t timeNanos =
+        timeNanos_ != 0
+            ? timeNanos_
+            : std::chrono::duration_cast<std::chrono::nanoseconds>(
+                  std::chrono::system_clock::now().time_since_epoch())
+                  .count();
+    out.WriteInt64Field(kProfileTimeNanos, timeNanos);
+    out.WriteInt64Field(kProfileDurationNanos, durationNanos_);
+    WriteValueType(&out, kProfilePeriodType, wallType, microsecondsUnit,
+                   &scratch);
+    out.WriteInt64Field(kProfilePeriod, intervalMicros_);
+
+    return out.data();
+  }
+
+ private:
+  struct Sample {
+    // Location ids, leaf first.
+    std::vector<uint64_t> stack;
+    int64_t hitCount;
+  };
+
+  struct Location {
+    uint64_t id;
+    uint64_t functionId;
+    int64_t line;
+  };
+
+  struct Function {
+    uint64_t id;
+    int64_t name;
+    int64_t filename;
+  };
+
+  void AddNode(const v8::CpuProfileNode* node, std::vector<uint64_t>* stack) {
+    stack->push_back(LocationId(node));
+    int64_t hitCount = node->GetHitCount();
+    if (hitCount > 0) {
+      // Within one profile stacks are unique, but when several profiles are
+      // merged the same stack recurs; sum its values instead of repeating it.
+      std::string key(reinterpret_cast<const char*>(stack->data()),
+                      stack->size() * sizeof(uint64_t));
+      auto it = sampleIds_.find(key);
+      if (it != sampleIds_.end()) {
+        samples_[it->second].hitCount += hitCount;
+      } else {
+        Sample sample;
+        sample.stack.assign(stack->rbegin(), stack->rend());
+        sample.hitCount = hitCount;
+        sampleIds_.emplace(std::move(key), samples_.size());
+        samples_.push_back(std::move(sample));
+      }
+    }
+    for (int i = 0; i < node->GetChildrenCount(); i++) {
+      AddNode(node->GetChild(i), stack);
+    }
+    stack->pop_back();
+  }
+
+  int64_t StringId(const std::string& str) {
+    auto it = stringIds_.find(str);
+    if (it != stringIds_.end()) return it->second;
+    int64_t id = strings_.size();
+    strings_.push_back(str);
+    stringIds_.emplace(str, id);
+    return id;
+  }
+
+  uint64_t FunctionId(const v8::CpuProfileNode* node) {
+    const char* name = node->GetFunctionNameStr();
+    int64_t nameId =
+        StringId(name != nullptr && name[0] != '\0' ? name : "(anonymous)");
+    uint64_t key = (static_cast<uint64_t>(node->GetScriptId()) << 32) |
+                   static_cast<uint64_t>(nameId);
+    auto it = functionIds_.find(key);
+    if (it != functionIds_.end()) return it->second;
+    Function function;
+    // Ids must be non-zero.
+    function.id = functions_.size() + 1;
+    function.name = nameId;
+    const char* scriptName = node->GetScriptResourceNameStr();
+    function.filename = StringId(scriptName != nullptr ? scriptName : "");
+    functions_.push_back(function);
+    functionIds_.emplace(key, function.id);
+    return function.id;
+  }
+
+  uint64_t LocationId(const v8::CpuProfileNode* node) {
+    uint64_t functionId = FunctionId(node);
+    int64_t line = node->GetLineNumber();
+    int64_t column = node->GetColumnNumber();
+    // The function id keys an outer map and line/column each get a full
+    // 32 bits of the inner key, so positions in minified single-line
+    // bundles (whose column numbers exceed any fixed bit budget) cannot
+    // alias distinct call sites.
+    uint64_t positionKey = (static_cast<uint64_t>(line) << 32) |
+                           (static_cast<uint64_t>(column) & 0xffffffff);
+    auto& perFunction = locationIds_[functionId];
+    auto it = perFunction.find(positionKey);
+    if (it != perFunction.end()) return it->second;
+    Location location;
+    location.id = locations_.size() + 1;
+    location.functionId = functionId;
+    location.line = line;
+    locations_.push_back(location);
+    perFunction.emplace(positionKey, location.id);
+    return location.id;
+  }
+
+  void WriteValueType(ProtoBuffer* out, int field, int64_t type, int64_t unit,
+                      ProtoBuffer* scratch) {
+    scratch->Clear();
+    scratch->WriteInt64Field(kValueTypeType, type);
+    scratch->WriteInt64Field(kValueTypeUnit, unit);
+    out->WriteMessageField(field, *scratch);
+  }
+
+  int64_t intervalMicros_;
+  int64_t timeNanos_ = 0;
+  int64_t durationNanos_ = 0;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, int64_t> stringIds_;
+  std::vector<Function> functions_;
+  std::unordered_map<uint64_t, uint64_t> functionIds_;
+  std::vector<Location> locations_;
+  // Location dedup: function id -> (line << 32 | column) -> location id.
+  std::unordered_map<uint64_t, std::unordered_map<uint64_t, uint64_t>>
+      locationIds_;
+  std::vector<Sample> samples_;
+  std::unordered_map<std::string, size_t> sampleIds_;
+};
+
+}  // namespace
+
+std::vector<char> EncodeTimeProfile(const v8::CpuProfile* profile,
+                                    int64_t intervalMicros) {
+  TimeProfileEncoder encoder(intervalMicros);
+  encoder.Add(profile);
+  return encoder.Encode();
+}
+
+class TimeProfileAggregator::Impl {
+ public:
+  explicit Impl(int64_t intervalMicros) : encoder(intervalMicros) {}
+  TimeProfileEncoder encoder;
+};
+
+TimeProfileAggregator::TimeProfileAggregator(int64_t intervalMicros)
+    : impl_(new Impl(intervalMicros)), intervalMicros_(intervalMicros) {}
+
+TimeProfileAggregator::~TimeProfileAggregator() = default;
+
+void TimeProfileAggregator::Add(const v8::CpuProfile* profile) {
+  impl_->encoder.Add(profile);
+  profileCount_++;
+}
+
+std::vector<char> TimeProfileAggregator::Flush() {
+  std::vector<char> encoded = impl_->encoder.Encode();
+  impl_.reset(new Impl(intervalMicros_));
+  profileCount_ = 0;
+  return encoded;
+}
+
+bool CompressGzip(const std::vector<char>& input, std::vector<char>* output) {
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  // windowBits of 15 + 16 selects the gzip format, matching zlib.gzipSync.
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                   Z_DEFAULT_STRATEGY) != Z_OK) {
+    return false;
+  }
+  output->resize(deflateBound(&stream, input.size()));
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(input.data()));
+  stream.avail_in = input.size();
+  stream.next_out = reinterpret_cast<Bytef*>(output->data());
+  stream.avail_out = output->size();
+  int result = deflate(&stream, Z_FINISH);
+  deflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    return false;
+  }
+  output->resize(stream.total_out);
+  return true;
+}
+
+}  // namespace pprof
@@ -0,0 +1,78 @@
+/**
+ * Copyright 2020 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BINDINGS_PROFILE_SERIALIZER_H_
+#define BINDINGS_PROFILE_SERIALIZER_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "v8-profiler.h"
+
+namespace pprof {
+
+// Encodes profile as a serialized perftools.profiles.Profile message
+// (per third_party/proto/profile.proto), equivalent to the output of
+// serializeTimeProfile in ts/src/profile-serializer.ts for the same profile.
+// intervalMicros is the average time between samples.
+//
+// Only the raw profile walk touches the v8::CpuProfile; no JS objects are
+// created, so this may be called without allocating on the JS heap.
+std::vector<char> EncodeTimeProfile(const v8::CpuProfile* profile,
+                                    int64_t intervalMicros);
+
+// Accumulates successive time profiles into one merged profile: samples with
+// identical stacks have their values summed, and the string, function, and
+// location tables are shared across all added profiles. Flush() emits the
+// merged profile as a serialized perftools.profiles.Profile message and
+// resets the aggregator for the next window. Durations of the added profiles
+// are summed; the emitted time_nanos is the wall time of the first Add since
+// the last Flush.
+//
+// Not thread-safe; intended to be owned by one isolate's profiler state.
+class TimeProfileAggregator {
+ public:
+  explicit TimeProfileAggregator(int64_t intervalMicros);
+  ~TimeProfileAggregator();
+  TimeProfileAggregator(const TimeProfileAggregator&) = delete;
+  TimeProfileAggregator& operator=(const TimeProfileAggregator&) = delete;
+
+  // Folds profile into the merged tree. Only the raw profile walk touches
+  // the v8::CpuProfile; no JS objects are created.
+  void Add(const v8::CpuProfile* profile);
+
+  // Emits the merged profile and resets the aggregator.
+  std::vector<char> Flush();
+
+  // Number of profiles added since construction or the last Flush.
+  int64_t profile_count() const { return profileCount_; }
+
+ private:
+  class Impl;
+  std::unique_ptr<Impl> impl_;
+  int64_t intervalMicros_;
+  int64_t profileCount_ = 0;
+};
+
+// Compresses input into the gzip format, as zlib.gzipSync would. Returns
+// false if compression fails. Does not touch the JS heap, so this may be
+// called from a worker thread.
+bool CompressGzip(const std::vector<char>& input, std::vector<char>* output);
+
+}  // namespace pprof
+
+#endif  // BINDINGS_PROFILE_SERIALIZER_H_
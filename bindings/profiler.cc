@@ -14,49 +14,613 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 #include "nan.h"
+#include "profile-serializer.h"
 #include "v8-profiler.h"
 
 using namespace v8;
 
+// Plain C++ copy of an AllocationProfile subtree. The copy is made on the
+// V8 thread (node names are JS strings), but it is a straight linear pass
+// with no JS allocation; everything that can run without the isolate is
+// deferred to a worker thread.
+struct AllocationNodeData {
+  std::string name;
+  std::string scriptName;
+  // Indices into the worker's deduplicated string table, assigned off the
+  // main thread.
+  int nameId = -1;
+  int scriptNameId = -1;
+  int scriptId;
+  int lineNumber;
+  int columnNumber;
+  std::vector<v8::AllocationProfile::Allocation> allocations;
+  std::vector<AllocationNodeData> children;
+};
+
+void CopyAllocationNode(v8::AllocationProfile::Node* node,
+                        AllocationNodeData* data) {
+  Nan::Utf8String name(node->name);
+  data->name = *name != nullptr ? *name : "";
+  Nan::Utf8String scriptName(node->script_name);
+  data->scriptName = *scriptName != nullptr ? *scriptName : "";
+  data->scriptId = node->script_id;
+  data->lineNumber = node->line_number;
+  data->columnNumber = node->column_number;
+  data->allocations = node->allocations;
+  data->children.resize(node->children.size());
+  for (size_t i = 0; i < node->children.size(); i++) {
+    CopyAllocationNode(node->children[i], &data->children[i]);
+  }
+}
+
+// Per-isolate profiler state. The addon's globals are shared by every
+// isolate that loads it (worker_threads load the same shared object), so all
+// state that is logically per-thread lives here, keyed by isolate and
+// created lazily on first use.
+struct IsolateData {
+  CpuProfiler* cpuProfiler = nullptr;
+  // Idle-dispose bookkeeping: sessions currently running plus stopped
+  // profiles not yet deleted. The profiler is disposed when both reach
+  // zero (see MaybeDisposeCpuProfiler).
+  int activeSessionCount = 0;
+  int outstandingProfileCount = 0;
+  // Ordered with a transparent comparator so InternString can look up a
+  // const char* key without materializing a std::string per call.
+  std::map<std::string, Eternal<String>, std::less<>> internedStrings;
+  // Continuous-profiling generation counter; -1 when not active.
+  int continuousGeneration = -1;
+  // Cumulative allocation counts from the previous delta collection, keyed
+  // by a hash of the node's call path plus the allocation size.
+  std::unordered_map<uint64_t, uint64_t> previousAllocationCounts;
+  // Multi-cycle profile aggregator; null when aggregation is not started.
+  std::unique_ptr<pprof::TimeProfileAggregator> timeAggregator;
+  // Heap profiler duty-cycling: allocation state preserved across
+  // pause/resume, plus the parameters needed to restart sampling.
+  std::unique_ptr<AllocationNodeData> pausedAllocationTree;
+  uint64_t heapIntervalBytes = 0;
+  int heapStackDepth = 0;
+  bool heapPaused = false;
+  // Label ranges for the timestamped-samples path: each range covers the
+  // wall-clock span during which a registered label set was current, so
+  // samples can be attributed to it by timestamp alone with no per-sample
+  // JS bookkeeping.
+  struct LabelRange {
+    double startMicros;
+    // 0 while the range is still open.
+    double endMicros;
+    size_t labelSetIndex;
+  };
+  std::vector<LabelRange> labelRanges;
+  std::vector<std::vector<std::pair<std::string, std::string>>> labelSets;
+  std::unordered_map<std::string, size_t> labelSetIds;
+  // Whether a session started with recordSamples (the only consumer of
+  // closed label ranges) is running. While false, SetLabels keeps only the
+  // range it opens, so per-request label registration stays bounded.
+  bool timestampedSessionActive = false;
+  // Memory-mapped profile export: the mapping is kept across cycles so each
+  // export is a write into an existing mapping, and the header's sequence
+  // counter lets the consuming sidecar detect updates and torn reads.
+#ifndef _WIN32
+  int sharedExportFd = -1;
+  void* sharedExportBase = nullptr;
+  size_t sharedExportSize = 0;
+  std::string sharedExportPath;
+  uint32_t sharedExportSequence = 0;
+#endif
+  // GC pause accounting: callbacks are installed once per isolate and stay
+  // installed, but only accumulate while gcTracking is set.
+  bool gcCallbacksInstalled = false;
+  bool gcTracking = false;
+  int64_t gcPauseStartMicros = 0;
+  int64_t gcPauseTotalMicros = 0;
+  int64_t gcCount = 0;
+};
+
+// Registry of per-isolate state, file-scope so the environment cleanup
+// hook below can erase entries as isolates die.
+std::mutex isolateDataMutex;
+std::unordered_map<Isolate*, IsolateData*> isolateDataRegistry;
+
+// Tears down an isolate's profiler state when its environment is
+// destroyed. Worker threads create and destroy isolates throughout the
+// process lifetime, and a freed Isolate's address can be reused for a
+// later worker, so the entry must be deleted and erased here rather than
+// left in the registry for an unrelated isolate to inherit.
+void DeleteIsolateData(void* arg) {
+  Isolate* isolate = static_cast<Isolate*>(arg);
+  IsolateData* data = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(isolateDataMutex);
+    auto it = isolateDataRegistry.find(isolate);
+    if (it == isolateDataRegistry.end()) {
+      return;
+    }
+    data = it->second;
+    isolateDataRegistry.erase(it);
+  }
+#if NODE_MODULE_VERSION > NODE_8_0_MODULE_VERSION
+  if (data->cpuProfiler != nullptr) {
+    data->cpuProfiler->Dispose();
+  }
+#endif
+#ifndef _WIN32
+  if (data->sharedExportBase != nullptr) {
+    munmap(data->sharedExportBase, data->sharedExportSize);
+  }
+  if (data->sharedExportFd != -1) {
+    close(data->sharedExportFd);
+  }
+#endif
+  delete data;
+}
+
+IsolateData* GetIsolateData() {
+  Isolate* isolate = Isolate::GetCurrent();
+  std::lock_guard<std::mutex> lock(isolateDataMutex);
+  auto it = isolateDataRegistry.find(isolate);
+  if (it != isolateDataRegistry.end()) {
+    return it->second;
+  }
+  IsolateData* data = new IsolateData();
+  isolateDataRegistry.emplace(isolate, data);
+  // Node 8 has no environment cleanup hooks (and no worker_threads whose
+  // exits would need them); its lone entry lives for the process.
+#if NODE_MODULE_VERSION > NODE_8_0_MODULE_VERSION
+  node::AddEnvironmentCleanupHook(isolate, DeleteIsolateData, isolate);
+#endif
+  return data;
+}
+
+CpuProfiler* GetCpuProfiler() {
+  IsolateData* data = GetIsolateData();
+  if (data->cpuProfiler == nullptr) {
+    // Created on first use and disposed again once idle (no running
+    // sessions and no outstanding profiles), so processes that only
+    // heap-profile never pay for CPU profiler setup and long gaps between
+    // collections release its buffers. On Node 8 the isolate owns the
+    // profiler and there is nothing to dispose.
+#if NODE_MODULE_VERSION > NODE_8_0_MODULE_VERSION
+    data->cpuProfiler = CpuProfiler::New(Isolate::GetCurrent());
+#else
+    data->cpuProfiler = Isolate::GetCurrent()->GetCpuProfiler();
+#endif
+  }
+  return data->cpuProfiler;
+}
+
+// Session and profile bookkeeping around the lazily-created profiler. Every
+// StartProfiling call goes through ProfilerSessionStarted, every
+// StopProfiling through ProfilerSessionStopped, and every CpuProfile
+// deletion through DeleteCpuProfile, so the counts in IsolateData always
+// reflect what the profiler still owns. Modes that must keep the profiler
+// alive across collections (continuous, aggregated, adaptive) start the
+// next session before stopping the previous one, so their counts never
+// touch zero mid-run.
+void ProfilerSessionStarted() { GetIsolateData()->activeSessionCount++; }
+
+void MaybeDisposeCpuProfiler() {
+#if NODE_MODULE_VERSION > NODE_8_0_MODULE_VERSION
+  IsolateData* data = GetIsolateData();
+  if (data->cpuProfiler != nullptr && data->activeSessionCount == 0 &&
+      data->outstandingProfileCount == 0) {
+    data->cpuProfiler->Dispose();
+    data->cpuProfiler = nullptr;
+  }
+#endif
+}
+
+// Stops the named session. The returned profile is owned by the profiler,
+// which therefore cannot be disposed until the profile has been handed to
+// DeleteCpuProfile.
+CpuProfile* ProfilerSessionStopped(Local<String> name) {
+  IsolateData* data = GetIsolateData();
+  CpuProfile* profile = GetCpuProfiler()->StopProfiling(name);
+  data->activeSessionCount--;
+  data->outstandingProfileCount++;
+  return profile;
+}
+
+void DeleteCpuProfile(CpuProfile* profile) {
+  profile->Delete();
+  GetIsolateData()->outstandingProfileCount--;
+  MaybeDisposeCpuProfiler();
+}
+
+// Cache of strings handed to JS, per isolate. Property keys and hot
+// function/script names recur on every node of every profile cycle, so the
+// handles are interned once in v8::Eternal storage and reused rather than
+// recreated per node with Nan::New<String>. Callers fetch the IsolateData
+// once per entry point and pass it down; looking it up here would take the
+// registry mutex inside the hottest loop of every translation.
+Local<String> InternString(IsolateData* data, const char* str) {
+  if (str == nullptr) str = "";
+  Isolate* isolate = Isolate::GetCurrent();
+  auto& cache = data->internedStrings;
+  auto it = cache.find(str);
+  if (it != cache.end()) {
+    return it->second.Get(isolate);
+  }
+  Local<String> handle = Nan::New<String>(str).ToLocalChecked();
+  cache[str].Set(isolate, handle);
+  return handle;
+}
+
+// Worklist entry for the iterative tree translations below: a node to
+// translate plus the slot in its parent's children array where the
+// translated node belongs. Parent arrays are referenced by index into a
+// parallel arena vector rather than held in the entry so the entries stay
+// plain data.
+template <typename NodeType>
+struct TranslationWorkItem {
+  NodeType node;
+  size_t parentArrayIndex;
+  uint32_t childIndex;
+  // Distance from the root, used to cap translated stack depth.
+  uint32_t depth;
+};
+
+// Reusable traversal storage: cleared (retaining capacity) at the start of
+// each translation so steady-state collections perform near-zero allocator
+// traffic, and with no recursion the translation handles arbitrarily deep
+// trees without exhausting the native stack. thread_local because worker
+// threads translate their own profiles concurrently.
+template <typename NodeType>
+std::vector<TranslationWorkItem<NodeType>>* GetTranslationWorklist() {
+  static thread_local std::vector<TranslationWorkItem<NodeType>> worklist;
+  worklist.clear();
+  return &worklist;
+}
+
+std::vector<Local<Array>>* GetTranslationArrayArena() {
+  static thread_local std::vector<Local<Array>> arrays;
+  arrays.clear();
+  return &arrays;
+}
+
 // Sampling Heap Profiler
 
-Local<Value> TranslateAllocationProfile(AllocationProfile::Node* node) {
-  Local<Object> js_node = Nan::New<Object>();
+Local<Value> TranslateAllocationProfile(IsolateData* data,
+                                        AllocationProfile::Node* root) {
+  std::vector<TranslationWorkItem<AllocationProfile::Node*>>* worklist =
+      GetTranslationWorklist<AllocationProfile::Node*>();
+  std::vector<Local<Array>>* arrays = GetTranslationArrayArena();
 
-  Nan::Set(js_node, Nan::New<String>("name").ToLocalChecked(), node->name);
-  Nan::Set(js_node, Nan::New<String>("scriptName").ToLocalChecked(),
-           node->script_name);
-  Nan::Set(js_node, Nan::New<String>("scriptId").ToLocalChecked(),
-           Nan::New<Integer>(node->script_id));
-  Nan::Set(js_node, Nan::New<String>("lineNumber").ToLocalChecked(),
-           Nan::New<Integer>(node->line_number));
-  Nan::Set(js_node, Nan::New<String>("columnNumber").ToLocalChecked(),
-           Nan::New<Integer>(node->column_number));
+  // Slot 0 holds the translated root.
+  arrays->push_back(Nan::New<Array>(1));
+  worklist->push_back({root, 0, 0, 0});
+  while (!worklist->empty()) {
+    TranslationWorkItem<AllocationProfile::Node*> item = worklist->back();
+    worklist->pop_back();
+    AllocationProfile::Node* node = item.node;
 
-  Local<Array> children = Nan::New<Array>(node->children.size());
+    Local<Object> js_node = Nan::New<Object>();
+    Nan::Set(js_node, InternString(data, "name"), node->name);
+    Nan::Set(js_node, InternString(data, "scriptName"), node->script_name);
+    Nan::Set(js_node, InternString(data, "scriptId"),
+             Nan::New<Integer>(node->script_id));
+    Nan::Set(js_node, InternString(data, "lineNumber"),
+             Nan::New<Integer>(node->line_number));
+    Nan::Set(js_node, InternString(data, "columnNumber"),
+             Nan::New<Integer>(node->column_number));
+
+    Local<Array> children = Nan::New<Array>(node->children.size());
+    size_t childrenArrayIndex = arrays->size();
+    arrays->push_back(children);
+    Nan::Set(js_node, InternString(data, "children"), children);
+    for (size_t i = 0; i < node->children.size(); i++) {
+      worklist->push_back({node->children[i], childrenArrayIndex,
+                           static_cast<uint32_t>(i), item.depth + 1});
+    }
+
+    Local<Array> allocations = Nan::New<Array>(node->allocations.size());
+    for (size_t i = 0; i < node->allocations.size(); i++) {
+      AllocationProfile::Allocation alloc = node->allocations[i];
+      Local<Object> js_alloc = Nan::New<Object>();
+      Nan::Set(js_alloc, InternString(data, "sizeBytes"),
+               Nan::New<Number>(alloc.size));
+      Nan::Set(js_alloc, InternString(data, "count"), Nan::New<Number>(alloc.count));
+      Nan::Set(allocations, i, js_alloc);
+    }
+    Nan::Set(js_node, InternString(data, "allocations"), allocations);
+
+    Nan::Set((*arrays)[item.parentArrayIndex], item.childIndex, js_node);
+  }
+  return Nan::Get((*arrays)[0], 0).ToLocalChecked();
+}
+
+uint64_t HashCombine(uint64_t seed, uint64_t value) {
+  return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+// Translates only the parts of the allocation tree that changed since the
+// previous delta collection, returning an empty handle for unchanged
+// subtrees (except the root, which is always emitted). nextCounts is filled
+// with the current cumulative counts for every visited node.
+MaybeLocal<Object> TranslateAllocationProfileDelta(
+    IsolateData* data, AllocationProfile::Node* node, uint64_t parentHash,
+    bool isRoot, std::unordered_map<uint64_t, uint64_t>* nextCounts) {
+  Nan::Utf8String name(node->name);
+  uint64_t nodeHash = HashCombine(
+      parentHash, std::hash<std::string>{}(*name != nullptr ? *name : ""));
+  nodeHash = HashCombine(nodeHash, node->script_id);
+  nodeHash = HashCombine(nodeHash, node->line_number);
+  nodeHash = HashCombine(nodeHash, node->column_number);
+
+  std::vector<Local<Object>> changedChildren;
   for (size_t i = 0; i < node->children.size(); i++) {
-    Nan::Set(children, i, TranslateAllocationProfile(node->children[i]));
+    Local<Object> child;
+    if (TranslateAllocationProfileDelta(data, node->children[i], nodeHash,
+                                        false, nextCounts)
+            .ToLocal(&child)) {
+      changedChildren.push_back(child);
+    }
   }
-  Nan::Set(js_node, Nan::New<String>("children").ToLocalChecked(), children);
-  Local<Array> allocations = Nan::New<Array>(node->allocations.size());
+
+  std::vector<AllocationProfile::Allocation> deltas;
+  auto& previousCounts = data->previousAllocationCounts;
   for (size_t i = 0; i < node->allocations.size(); i++) {
     AllocationProfile::Allocation alloc = node->allocations[i];
+    uint64_t key = HashCombine(nodeHash, alloc.size);
+    (*nextCounts)[key] = alloc.count;
+    auto it = previousCounts.find(key);
+    uint64_t previousCount = it != previousCounts.end() ? it->second : 0;
+    if (alloc.count > previousCount) {
+      alloc.count -= previousCount;
+      deltas.push_back(alloc);
+    }
+  }
+
+  if (!isRoot && deltas.empty() && changedChildren.empty()) {
+    return MaybeLocal<Object>();
+  }
+
+  Local<Object> js_node = Nan::New<Object>();
+  Nan::Set(js_node, InternString(data, "name"), node->name);
+  Nan::Set(js_node, InternString(data, "scriptName"), node->script_name);
+  Nan::Set(js_node, InternString(data, "scriptId"),
+           Nan::New<Integer>(node->script_id));
+  Nan::Set(js_node, InternString(data, "lineNumber"),
+           Nan::New<Integer>(node->line_number));
+  Nan::Set(js_node, InternString(data, "columnNumber"),
+           Nan::New<Integer>(node->column_number));
+  Local<Array> children = Nan::New<Array>(changedChildren.size());
+  for (size_t i = 0; i < changedChildren.size(); i++) {
+    Nan::Set(children, i, changedChildren[i]);
+  }
+  Nan::Set(js_node, InternString(data, "children"), children);
+  Local<Array> allocations = Nan::New<Array>(deltas.size());
+  for (size_t i = 0; i < deltas.size(); i++) {
     Local<Object> js_alloc = Nan::New<Object>();
-    Nan::Set(js_alloc, Nan::New<String>("sizeBytes").ToLocalChecked(),
-             Nan::New<Number>(alloc.size));
-    Nan::Set(js_alloc, Nan::New<String>("count").ToLocalChecked(),
-             Nan::New<Number>(alloc.count));
+    Nan::Set(js_alloc, InternString(data, "sizeBytes"),
+             Nan::New<Number>(deltas[i].size));
+    Nan::Set(js_alloc, InternString(data, "count"),
+             Nan::New<Number>(deltas[i].count));
     Nan::Set(allocations, i, js_alloc);
   }
-  Nan::Set(js_node, Nan::New<String>("allocations").ToLocalChecked(),
-           allocations);
+  Nan::Set(js_node, InternString(data, "allocations"), allocations);
+  return js_node;
+}
+
+void MergeAllocationNode(const AllocationNodeData& src,
+                         AllocationNodeData* dst);
+
+// Builds the JS allocation profile off the main thread: the snapshot is
+// copied into plain structs while the isolate is held, string deduplication
+// runs on a libuv worker thread, and the final JS tree is materialized from
+// one JS string per unique name instead of one conversion per node.
+class GetAllocationProfileWorker : public Nan::AsyncWorker {
+ public:
+  explicit GetAllocationProfileWorker(Nan::Callback* callback)
+      : Nan::AsyncWorker(callback, "pprof:GetAllocationProfileWorker") {}
+
+  // Called on the V8 thread before the worker is queued.
+  void CopyProfile(AllocationProfile::Node* root) {
+    CopyAllocationNode(root, &root_);
+  }
+
+  // Called instead of CopyProfile while sampling is paused; the preserved
+  // tree is the whole profile.
+  void CopyPreserved(const AllocationNodeData& preserved) {
+    root_ = preserved;
+  }
+
+  // Folds state preserved across earlier pause/resume cycles into the
+  // copied tree, mirroring getAllocationProfile.
+  void MergePreserved(const AllocationNodeData& preserved) {
+    MergeAllocationNode(preserved, &root_);
+  }
+
+  void Execute() override { AssignStringIds(&root_); }
+
+  void HandleOKCallback() override {
+    Nan::HandleScope scope;
+    IsolateData* data = GetIsolateData();
+    std::vector<Local<String>> jsStrings;
+    jsStrings.reserve(strings_.size());
+    for (const std::string& str : strings_) {
+      jsStrings.push_back(Nan::New<String>(str).ToLocalChecked());
+    }
+    Local<Value> argv[] = {Nan::Null(), BuildNode(data, root_, jsStrings)};
+    callback->Call(2, argv, async_resource);
+  }
+
+ private:
+  void AssignStringIds(AllocationNodeData* node) {
+    node->nameId = StringId(node->name);
+    node->scriptNameId = StringId(node->scriptName);
+    for (size_t i = 0; i < node->children.size(); i++) {
+      AssignStringIds(&node->children[i]);
+    }
+  }
+
+  int StringId(const std::string& str) {
+    auto it = stringIds_.find(str);
+    if (it != stringIds_.end()) return it->second;
+    int id = strings_.size();
+    strings_.push_back(str);
+    stringIds_.emplace(str, id);
+    return id;
+  }
+
+  Local<Object> BuildNode(IsolateData* data, const AllocationNodeData& node,
+                          const std::vector<Local<String>>& jsStrings) {
+    Local<Object> js_node = Nan::New<Object>();
+    Nan::Set(js_node, InternString(data, "name"), jsStrings[node.nameId]);
+    Nan::Set(js_node, InternString(data, "scriptName"),
+             jsStrings[node.scriptNameId]);
+    Nan::Set(js_node, InternString(data, "scriptId"),
+             Nan::New<Integer>(node.scriptId));
+    Nan::Set(js_node, InternString(data, "lineNumber"),
+             Nan::New<Integer>(node.lineNumber));
+    Nan::Set(js_node, InternString(data, "columnNumber"),
+             Nan::New<Integer>(node.columnNumber));
+    Local<Array> children = Nan::New<Array>(node.children.size());
+    for (size_t i = 0; i < node.children.size(); i++) {
+      Nan::Set(children, i, BuildNode(data, node.children[i], jsStrings));
+    }
+    Nan::Set(js_node, InternString(data, "children"), children);
+    Local<Array> allocations = Nan::New<Array>(node.allocations.size());
+    for (size_t i = 0; i < node.allocations.size(); i++) {
+      Local<Object> js_alloc = Nan::New<Object>();
+      Nan::Set(js_alloc, InternString(data, "sizeBytes"),
+               Nan::New<Number>(node.allocations[i].size));
+      Nan::Set(js_alloc, InternString(data, "count"),
+               Nan::New<Number>(node.allocations[i].count));
+      Nan::Set(allocations, i, js_alloc);
+    }
+    Nan::Set(js_node, InternString(data, "allocations"), allocations);
+    return js_node;
+  }
+
+  AllocationNodeData root_;
+  std::vector<std::string> strings_;
+  std::unordered_map<std::string, int> stringIds_;
+};
+
+// Signature:
+// getAllocationProfileAsync(
+//     callback: (err: Error|null, profile?: AllocationProfileNode) => void)
+NAN_METHOD(GetAllocationProfileAsync) {
+  if (info.Length() != 1 || !info[0]->IsFunction()) {
+    return Nan::ThrowTypeError("First argument must be a function.");
+  }
+  Nan::Callback* callback = new Nan::Callback(info[0].As<Function>());
+  GetAllocationProfileWorker* worker =
+      new GetAllocationProfileWorker(callback);
+  IsolateData* data = GetIsolateData();
+  if (data->heapPaused) {
+    // Sampling is halted (GetAllocationProfile would return nullptr); the
+    // preserved tree is the whole profile.
+    worker->CopyPreserved(*data->pausedAllocationTree);
+  } else {
+    std::unique_ptr<v8::AllocationProfile> profile(
+        info.GetIsolate()->GetHeapProfiler()->GetAllocationProfile());
+    if (profile == nullptr) {
+      delete worker;
+      return Nan::ThrowError("Heap profiler is not active.");
+    }
+    worker->CopyProfile(profile->GetRootNode());
+    if (data->pausedAllocationTree) {
+      worker->MergePreserved(*data->pausedAllocationTree);
+    }
+  }
+  Nan::AsyncQueueWorker(worker);
+}
+
+// Merges src into dst: children are matched on call-site identity
+// (name, script, and position) and allocation samples on size; counts of
+// matching entries are summed, unmatched subtrees are copied over.
+void MergeAllocationNode(const AllocationNodeData& src,
+                         AllocationNodeData* dst) {
+  for (const auto& alloc : src.allocations) {
+    bool merged = false;
+    for (auto& existing : dst->allocations) {
+      if (existing.size == alloc.size) {
+        existing.count += alloc.count;
+        merged = true;
+        break;
+      }
+    }
+    if (!merged) {
+      dst->allocations.push_back(alloc);
+    }
+  }
+  for (const auto& child : src.children) {
+    AllocationNodeData* match = nullptr;
+    for (auto& existing : dst->children) {
+      if (existing.scriptId == child.scriptId &&
+          existing.lineNumber == child.lineNumber &&
+          existing.columnNumber == child.columnNumber &&
+          existing.name == child.name &&
+          existing.scriptName == child.scriptName) {
+        match = &existing;
+        break;
+      }
+    }
+    if (match != nullptr) {
+      MergeAllocationNode(child, match);
+    } else {
+      dst->children.push_back(child);
+    }
+  }
+}
+
+// Translates a plain-struct allocation tree (see AllocationNodeData) into
+// the same JS shape TranslateAllocationProfile produces.
+Local<Object> TranslatePlainAllocationNode(IsolateData* data,
+                                           const AllocationNodeData& node) {
+  Local<Object> js_node = Nan::New<Object>();
+  Nan::Set(js_node, InternString(data, "name"), InternString(data, node.name.c_str()));
+  Nan::Set(js_node, InternString(data, "scriptName"),
+           InternString(data, node.scriptName.c_str()));
+  Nan::Set(js_node, InternString(data, "scriptId"),
+           Nan::New<Integer>(node.scriptId));
+  Nan::Set(js_node, InternString(data, "lineNumber"),
+           Nan::New<Integer>(node.lineNumber));
+  Nan::Set(js_node, InternString(data, "columnNumber"),
+           Nan::New<Integer>(node.columnNumber));
+  Local<Array> children = Nan::New<Array>(node.children.size());
+  for (size_t i = 0; i < node.children.size(); i++) {
+    Nan::Set(children, i,
+             TranslatePlainAllocationNode(data, node.children[i]));
+  }
+  Nan::Set(js_node, InternString(data, "children"), children);
+  Local<Array> allocations = Nan::New<Array>(node.allocations.size());
+  for (size_t i = 0; i < node.allocations.size(); i++) {
+    Local<Object> js_alloc = Nan::New<Object>();
+    Nan::Set(js_alloc, InternString(data, "sizeBytes"),
+             Nan::New<Number>(node.allocations[i].size));
+    Nan::Set(js_alloc, InternString(data, "count"),
+             Nan::New<Number>(node.allocations[i].count));
+    Nan::Set(allocations, i, js_alloc);
+  }
+  Nan::Set(js_node, InternString(data, "allocations"), allocations);
   return js_node;
 }
 
 NAN_METHOD(StartSamplingHeapProfiler) {
+  IsolateData* data = GetIsolateData();
+  // A fresh start discards state preserved by a previous pause.
+  data->pausedAllocationTree.reset();
+  data->heapPaused = false;
   if (info.Length() == 2) {
     if (!info[0]->IsUint32()) {
       return Nan::ThrowTypeError("First argument type must be uint32.");
@@ -73,9 +637,13 @@ NAN_METHOD(StartSamplingHeapProfiler) {
     int stack_depth = info[1].As<Integer>()->IntegerValue();
 #endif
 
+    data->heapIntervalBytes = sample_interval;
+    data->heapStackDepth = stack_depth;
     info.GetIsolate()->GetHeapProfiler()->StartSamplingHeapProfiler(
         sample_interval, stack_depth);
   } else {
+    data->heapIntervalBytes = 0;
+    data->heapStackDepth = 0;
     info.GetIsolate()->GetHeapProfiler()->StartSamplingHeapProfiler();
   }
 }
@@ -83,52 +651,150 @@ NAN_METHOD(StartSamplingHeapProfiler) {
 // Signature:
 // stopSamplingHeapProfiler()
 NAN_METHOD(StopSamplingHeapProfiler) {
+  IsolateData* data = GetIsolateData();
+  if (!data->heapPaused) {
+    info.GetIsolate()->GetHeapProfiler()->StopSamplingHeapProfiler();
+  }
+  // Counts restart from zero if the profiler is started again.
+  data->previousAllocationCounts.clear();
+  data->pausedAllocationTree.reset();
+  data->heapPaused = false;
+}
+
+// Signature:
+// pauseSamplingHeapProfiler()
+//
+// Snapshots the accumulated allocation tree into native storage and halts
+// sampling, so heap profiling can be duty-cycled under load without losing
+// long-lived allocation attribution. No-op when already paused.
+NAN_METHOD(PauseSamplingHeapProfiler) {
+  IsolateData* data = GetIsolateData();
+  if (data->heapPaused) {
+    return;
+  }
+  std::unique_ptr<AllocationNodeData> snapshot(new AllocationNodeData());
+  {
+    std::unique_ptr<v8::AllocationProfile> profile(
+        info.GetIsolate()->GetHeapProfiler()->GetAllocationProfile());
+    if (profile == nullptr) {
+      return Nan::ThrowError("Heap profiler is not active.");
+    }
+    CopyAllocationNode(profile->GetRootNode(), snapshot.get());
+  }
+  if (data->pausedAllocationTree) {
+    // State preserved across earlier pause/resume cycles folds into the new
+    // snapshot so nothing is lost across repeated duty cycles.
+    MergeAllocationNode(*data->pausedAllocationTree, snapshot.get());
+  }
+  data->pausedAllocationTree = std::move(snapshot);
   info.GetIsolate()->GetHeapProfiler()->StopSamplingHeapProfiler();
+  data->heapPaused = true;
+}
+
+// Signature:
+// resumeSamplingHeapProfiler()
+//
+// Restarts sampling with the parameters from the original start. The
+// preserved tree is merged into subsequent collections. No-op when not
+// paused.
+NAN_METHOD(ResumeSamplingHeapProfiler) {
+  IsolateData* data = GetIsolateData();
+  if (!data->heapPaused) {
+    return;
+  }
+  if (data->heapIntervalBytes > 0) {
+    info.GetIsolate()->GetHeapProfiler()->StartSamplingHeapProfiler(
+        data->heapIntervalBytes, data->heapStackDepth);
+  } else {
+    info.GetIsolate()->GetHeapProfiler()->StartSamplingHeapProfiler();
+  }
+  // The fresh sampler counts from zero; comparing against the baseline from
+  // before the pause would make every count look like a decrease and
+  // silently drop allocations from the next delta, which instead reports a
+  // full collection.
+  data->previousAllocationCounts.clear();
+  data->heapPaused = false;
 }
 
 // Signature:
 // getAllocationProfile(): AllocationProfileNode
 NAN_METHOD(GetAllocationProfile) {
+  IsolateData* data = GetIsolateData();
+  if (data->heapPaused) {
+    // Sampling is halted; the preserved tree is the whole profile.
+    info.GetReturnValue().Set(
+        TranslatePlainAllocationNode(data, *data->pausedAllocationTree));
+    return;
+  }
   std::unique_ptr<v8::AllocationProfile> profile(
       info.GetIsolate()->GetHeapProfiler()->GetAllocationProfile());
+  if (profile == nullptr) {
+    return Nan::ThrowError("Heap profiler is not active.");
+  }
   AllocationProfile::Node* root = profile->GetRootNode();
-  info.GetReturnValue().Set(TranslateAllocationProfile(root));
+  if (data->pausedAllocationTree) {
+    AllocationNodeData merged;
+    CopyAllocationNode(root, &merged);
+    MergeAllocationNode(*data->pausedAllocationTree, &merged);
+    info.GetReturnValue().Set(TranslatePlainAllocationNode(data, merged));
+    return;
+  }
+  info.GetReturnValue().Set(TranslateAllocationProfile(data, root));
 }
 
-// Time profiler
+// Signature:
+// getAllocationProfileDelta(): AllocationProfileNode
+//
+// Like getAllocationProfile, but only translates nodes whose allocation
+// counts grew since the previous delta collection, so slowly-changing heaps
+// cost proportionally to their churn rather than their size.
+NAN_METHOD(GetAllocationProfileDelta) {
+  IsolateData* data = GetIsolateData();
+  if (data->heapPaused) {
+    // Sampling is halted, so there is no live profile to diff against;
+    // delta collection resumes with the profiler.
+    return Nan::ThrowError("Heap profiler is paused.");
+  }
+  std::unique_ptr<v8::AllocationProfile> profile(
+      info.GetIsolate()->GetHeapProfiler()->GetAllocationProfile());
+  if (profile == nullptr) {
+    return Nan::ThrowError("Heap profiler is not active.");
+  }
+  AllocationProfile::Node* root = profile->GetRootNode();
+  std::unordered_map<uint64_t, uint64_t> nextCounts;
+  Local<Object> translated =
+      TranslateAllocationProfileDelta(data, root, 0, true, &nextCounts)
+          .ToLocalChecked();
+  data->previousAllocationCounts = std::move(nextCounts);
+  info.GetReturnValue().Set(translated);
+}
 
-#if NODE_MODULE_VERSION > NODE_8_0_MODULE_VERSION
-// This profiler exists for the lifetime of the program. Not calling
-// CpuProfiler::Dispose() is intentional.
-CpuProfiler* cpuProfiler = CpuProfiler::New(v8::Isolate::GetCurrent());
-#else
-CpuProfiler* cpuProfiler = v8::Isolate::GetCurrent()->GetCpuProfiler();
-#endif
+// Time profiler
 
-Local<Object> CreateTimeNode(Local<String> name, Local<String> scriptName,
+Local<Object> CreateTimeNode(IsolateData* data, Local<String> name,
+                             Local<String> scriptName,
                              Local<Integer> scriptId, Local<Integer> lineNumber,
                              Local<Integer> columnNumber,
                              Local<Integer> hitCount, Local<Array> children) {
   Local<Object> js_node = Nan::New<Object>();
-  Nan::Set(js_node, Nan::New<String>("name").ToLocalChecked(), name);
-  Nan::Set(js_node, Nan::New<String>("scriptName").ToLocalChecked(),
-           scriptName);
-  Nan::Set(js_node, Nan::New<String>("scriptId").ToLocalChecked(), scriptId);
-  Nan::Set(js_node, Nan::New<String>("lineNumber").ToLocalChecked(),
-           lineNumber);
-  Nan::Set(js_node, Nan::New<String>("columnNumber").ToLocalChecked(),
-           columnNumber);
-  Nan::Set(js_node, Nan::New<String>("hitCount").ToLocalChecked(), hitCount);
-  Nan::Set(js_node, Nan::New<String>("children").ToLocalChecked(), children);
+  Nan::Set(js_node, InternString(data, "name"), name);
+  Nan::Set(js_node, InternString(data, "scriptName"), scriptName);
+  Nan::Set(js_node, InternString(data, "scriptId"), scriptId);
+  Nan::Set(js_node, InternString(data, "lineNumber"), lineNumber);
+  Nan::Set(js_node, InternString(data, "columnNumber"), columnNumber);
+  Nan::Set(js_node, InternString(data, "hitCount"), hitCount);
+  Nan::Set(js_node, InternString(data, "children"), children);
 
   return js_node;
 }
 
 #if NODE_MODULE_VERSION > NODE_11_0_MODULE_VERSION
-Local<Object> TranslateLineNumbersTimeProfileNode(const CpuProfileNode* parent,
+Local<Object> TranslateLineNumbersTimeProfileNode(IsolateData* data,
+                                                  const CpuProfileNode* parent,
                                                   const CpuProfileNode* node);
 
-Local<Array> GetLineNumberTimeProfileChildren(const CpuProfileNode* parent,
+Local<Array> GetLineNumberTimeProfileChildren(IsolateData* data,
+                                              const CpuProfileNode* parent,
                                               const CpuProfileNode* node) {
   unsigned int index = 0;
   Local<Array> children;
@@ -137,13 +803,17 @@ Local<Array> GetLineNumberTimeProfileChildren(const CpuProfileNode* parent,
   unsigned int hitLineCount = node->GetHitLineCount();
   unsigned int hitCount = node->GetHitCount();
   if (hitLineCount > 0) {
-    std::vector<CpuProfileNode::LineTick> entries(hitLineCount);
+    // Reusable scratch buffer for line ticks; fully consumed before the
+    // recursive calls below can reuse it.
+    static thread_local std::vector<CpuProfileNode::LineTick> entries;
+    entries.resize(hitLineCount);
     node->GetLineTicks(&entries[0], hitLineCount);
     children = Nan::New<Array>(count + hitLineCount);
     for (const CpuProfileNode::LineTick entry : entries) {
       Nan::Set(children, index++,
                CreateTimeNode(
-                   node->GetFunctionName(), node->GetScriptResourceName(),
+                   data, InternString(data, node->GetFunctionNameStr()),
+                   InternString(data, node->GetScriptResourceNameStr()),
                    Nan::New<Integer>(node->GetScriptId()),
                    Nan::New<Integer>(entry.line), Nan::New<Integer>(0),
                    Nan::New<Integer>(entry.hit_count), Nan::New<Array>(0)));
@@ -154,7 +824,8 @@ Local<Array> GetLineNumberTimeProfileChildren(const CpuProfileNode* parent,
     children = Nan::New<Array>(count + 1);
     Nan::Set(
         children, index++,
-        CreateTimeNode(node->GetFunctionName(), node->GetScriptResourceName(),
+        CreateTimeNode(data, InternString(data, node->GetFunctionNameStr()),
+                       InternString(data, node->GetScriptResourceNameStr()),
                        Nan::New<Integer>(node->GetScriptId()),
                        Nan::New<Integer>(node->GetLineNumber()),
                        Nan::New<Integer>(node->GetColumnNumber()),
@@ -165,31 +836,36 @@ Local<Array> GetLineNumberTimeProfileChildren(const CpuProfileNode* parent,
 
   for (int32_t i = 0; i < count; i++) {
     Nan::Set(children, index++,
-             TranslateLineNumbersTimeProfileNode(node, node->GetChild(i)));
+             TranslateLineNumbersTimeProfileNode(data, node,
+                                                 node->GetChild(i)));
   };
 
   return children;
 }
 
-Local<Object> TranslateLineNumbersTimeProfileNode(const CpuProfileNode* parent,
+Local<Object> TranslateLineNumbersTimeProfileNode(IsolateData* data,
+                                                  const CpuProfileNode* parent,
                                                   const CpuProfileNode* node) {
   return CreateTimeNode(
-      parent->GetFunctionName(), parent->GetScriptResourceName(),
+      data, InternString(data, parent->GetFunctionNameStr()),
+      InternString(data, parent->GetScriptResourceNameStr()),
       Nan::New<Integer>(parent->GetScriptId()),
       Nan::New<Integer>(node->GetLineNumber()),
       Nan::New<Integer>(node->GetColumnNumber()), Nan::New<Integer>(0),
-      GetLineNumberTimeProfileChildren(parent, node));
+      GetLineNumberTimeProfileChildren(data, parent, node));
 }
 
 // In profiles with line level accurate line numbers, a node's line number
 // and column number refer to the line/column from which the function was
 // called.
-Local<Value> TranslateLineNumbersTimeProfileRoot(const CpuProfileNode* node) {
+Local<Value> TranslateLineNumbersTimeProfileRoot(IsolateData* data,
+                                                 const CpuProfileNode* node) {
   int32_t count = node->GetChildrenCount();
   std::vector<Local<Array>> childrenArrs(count);
   int32_t childCount = 0;
   for (int32_t i = 0; i < count; i++) {
-    Local<Array> c = GetLineNumberTimeProfileChildren(node, node->GetChild(i));
+    Local<Array> c =
+        GetLineNumberTimeProfileChildren(data, node, node->GetChild(i));
     childCount = childCount + c->Length();
     childrenArrs[i] = c;
   }
@@ -204,7 +880,8 @@ Local<Value> TranslateLineNumbersTimeProfileRoot(const CpuProfileNode* node) {
     }
   }
 
-  return CreateTimeNode(node->GetFunctionName(), node->GetScriptResourceName(),
+  return CreateTimeNode(data, InternString(data, node->GetFunctionNameStr()),
+                   InternString(data, node->GetScriptResourceNameStr()),
                         Nan::New<Integer>(node->GetScriptId()),
                         Nan::New<Integer>(node->GetLineNumber()),
                         Nan::New<Integer>(node->GetColumnNumber()),
@@ -212,50 +889,184 @@ Local<Value> TranslateLineNumbersTimeProfileRoot(const CpuProfileNode* node) {
 }
 #endif
 
-Local<Value> TranslateTimeProfileNode(const CpuProfileNode* node) {
+// Sums the hit counts of node and all of its descendants.
+uint64_t SubtreeHitCount(const CpuProfileNode* node) {
+  uint64_t hits = node->GetHitCount();
+  for (int32_t i = 0; i < node->GetChildrenCount(); i++) {
+    hits += SubtreeHitCount(node->GetChild(i));
+  }
+  return hits;
+}
+
+// maxDepth of 0 means unlimited. Nodes at the depth cap absorb the hit
+// counts of their untranslated descendants, so total sample counts are
+// preserved while the frames below the cap are never materialized.
+// includeNodeIds adds each node's V8 node id, needed to correlate nodes
+// with a recorded sample stream.
+Local<Value> TranslateTimeProfileNode(IsolateData* data,
+                                      const CpuProfileNode* root,
+                                      uint32_t maxDepth,
+                                      bool includeNodeIds = false) {
+  std::vector<TranslationWorkItem<const CpuProfileNode*>>* worklist =
+      GetTranslationWorklist<const CpuProfileNode*>();
+  std::vector<Local<Array>>* arrays = GetTranslationArrayArena();
+
+  // Slot 0 holds the translated root.
+  arrays->push_back(Nan::New<Array>(1));
+  worklist->push_back({root, 0, 0, 0});
+  while (!worklist->empty()) {
+    TranslationWorkItem<const CpuProfileNode*> item = worklist->back();
+    worklist->pop_back();
+    const CpuProfileNode* node = item.node;
+
+    uint64_t hitCount = node->GetHitCount();
+    Local<Array> children;
+    if (maxDepth > 0 && item.depth >= maxDepth) {
+      hitCount = SubtreeHitCount(node);
+      children = Nan::New<Array>(0);
+    } else {
+      int32_t count = node->GetChildrenCount();
+      children = Nan::New<Array>(count);
+      size_t childrenArrayIndex = arrays->size();
+      arrays->push_back(children);
+      for (int32_t i = 0; i < count; i++) {
+        worklist->push_back({node->GetChild(i), childrenArrayIndex,
+                             static_cast<uint32_t>(i), item.depth + 1});
+      }
+    }
+
+    Local<Object> js_node =
+        CreateTimeNode(data, InternString(data, node->GetFunctionNameStr()),
+                       InternString(data, node->GetScriptResourceNameStr()),
+                       Nan::New<Integer>(node->GetScriptId()),
+                       Nan::New<Integer>(node->GetLineNumber()),
+                       Nan::New<Integer>(node->GetColumnNumber()),
+                       Nan::New<Integer>(static_cast<uint32_t>(hitCount)),
+                       children);
+    if (includeNodeIds) {
+      Nan::Set(js_node, InternString(data, "nodeId"),
+               Nan::New<Integer>(node->GetNodeId()));
+    }
+    Nan::Set((*arrays)[item.parentArrayIndex], item.childIndex, js_node);
+  }
+  return Nan::Get((*arrays)[0], 0).ToLocalChecked();
+}
+
+// Filtered translation: prunes subtrees whose script name contains
+// scriptFilter (mirroring ignoreSamplesPath in profile-serializer.ts) and
+// subtrees whose total hit count is below minHitCount, so pruned nodes are
+// never materialized as JS objects. Returns an empty MaybeLocal when the
+// subtree is pruned. *subtreeHits is set to the subtree's total hit count;
+// it is 0 when the subtree was pruned by the script filter, while
+// threshold-pruned subtrees still report their hits so ancestors count them.
+MaybeLocal<Object> TranslateFilteredTimeProfileNode(
+    IsolateData* data, const CpuProfileNode* node,
+    const std::string& scriptFilter, uint32_t minHitCount, bool isRoot,
+    uint64_t* subtreeHits) {
+  *subtreeHits = 0;
+  if (!isRoot && !scriptFilter.empty()) {
+    const char* scriptName = node->GetScriptResourceNameStr();
+    if (scriptName != nullptr &&
+        strstr(scriptName, scriptFilter.c_str()) != nullptr) {
+      return MaybeLocal<Object>();
+    }
+  }
+
   int32_t count = node->GetChildrenCount();
-  Local<Array> children = Nan::New<Array>(count);
+  std::vector<Local<Object>> translatedChildren;
+  translatedChildren.reserve(count);
+  uint64_t hits = node->GetHitCount();
   for (int32_t i = 0; i < count; i++) {
-    Nan::Set(children, i, TranslateTimeProfileNode(node->GetChild(i)));
+    uint64_t childHits = 0;
+    Local<Object> child;
+    if (TranslateFilteredTimeProfileNode(data, node->GetChild(i), scriptFilter,
+                                         minHitCount, false, &childHits)
+            .ToLocal(&child)) {
+      translatedChildren.push_back(child);
+    }
+    hits += childHits;
+  }
+  *subtreeHits = hits;
+  if (!isRoot && hits < minHitCount) {
+    return MaybeLocal<Object>();
   }
 
-  return CreateTimeNode(node->GetFunctionName(), node->GetScriptResourceName(),
+  Local<Array> children = Nan::New<Array>(translatedChildren.size());
+  for (size_t i = 0; i < translatedChildren.size(); i++) {
+    Nan::Set(children, i, translatedChildren[i]);
+  }
+  return CreateTimeNode(data, InternString(data, node->GetFunctionNameStr()),
+                        InternString(data, node->GetScriptResourceNameStr()),
                         Nan::New<Integer>(node->GetScriptId()),
                         Nan::New<Integer>(node->GetLineNumber()),
                         Nan::New<Integer>(node->GetColumnNumber()),
                         Nan::New<Integer>(node->GetHitCount()), children);
 }
 
-Local<Value> TranslateTimeProfile(const CpuProfile* profile,
-                                  bool includeLineInfo) {
+Local<Value> TranslateFilteredTimeProfile(IsolateData* data,
+                                          const CpuProfile* profile,
+                                          const std::string& scriptFilter,
+                                          uint32_t minHitCount) {
   Local<Object> js_profile = Nan::New<Object>();
-  Nan::Set(js_profile, Nan::New<String>("title").ToLocalChecked(),
+  Nan::Set(js_profile, InternString(data, "title"), profile->GetTitle());
+  uint64_t subtreeHits = 0;
+  Nan::Set(js_profile, InternString(data, "topDownRoot"),
+           TranslateFilteredTimeProfileNode(data, profile->GetTopDownRoot(),
+                                            scriptFilter, minHitCount, true,
+                                            &subtreeHits)
+               .ToLocalChecked());
+  Nan::Set(js_profile, InternString(data, "startTime"),
+           Nan::New<Number>(profile->GetStartTime()));
+  Nan::Set(js_profile, InternString(data, "endTime"),
+           Nan::New<Number>(profile->GetEndTime()));
+  return js_profile;
+}
+
+Local<Value> TranslateTimeProfile(IsolateData* data,
+                                  const CpuProfile* profile,
+                                  bool includeLineInfo,
+                                  uint32_t maxDepth = 0,
+                                  bool includeNodeIds = false) {
+  Local<Object> js_profile = Nan::New<Object>();
+  Nan::Set(js_profile, InternString(data, "title"),
            profile->GetTitle());
 
 #if NODE_MODULE_VERSION > NODE_11_0_MODULE_VERSION
   if (includeLineInfo) {
-    Nan::Set(js_profile, Nan::New<String>("topDownRoot").ToLocalChecked(),
-             TranslateLineNumbersTimeProfileRoot(profile->GetTopDownRoot()));
+    Nan::Set(js_profile, InternString(data, "topDownRoot"),
+             TranslateLineNumbersTimeProfileRoot(data,
+                                                 profile->GetTopDownRoot()));
   } else {
-    Nan::Set(js_profile, Nan::New<String>("topDownRoot").ToLocalChecked(),
-             TranslateTimeProfileNode(profile->GetTopDownRoot()));
+    Nan::Set(js_profile, InternString(data, "topDownRoot"),
+             TranslateTimeProfileNode(data, profile->GetTopDownRoot(),
+                                      maxDepth, includeNodeIds));
   }
 #else
-  Nan::Set(js_profile, Nan::New<String>("topDownRoot").ToLocalChecked(),
-           TranslateTimeProfileNode(profile->GetTopDownRoot()));
+  Nan::Set(js_profile, InternString(data, "topDownRoot"),
+           TranslateTimeProfileNode(data, profile->GetTopDownRoot(), maxDepth,
+                                    includeNodeIds));
 #endif
-  Nan::Set(js_profile, Nan::New<String>("startTime").ToLocalChecked(),
+  Nan::Set(js_profile, InternString(data, "startTime"),
            Nan::New<Number>(profile->GetStartTime()));
-  Nan::Set(js_profile, Nan::New<String>("endTime").ToLocalChecked(),
+  Nan::Set(js_profile, InternString(data, "endTime"),
            Nan::New<Number>(profile->GetEndTime()));
   return js_profile;
 }
 
 // Signature:
-// startProfiling(runName: string, includeLineInfo: boolean)
+// startProfiling(runName: string, includeLineInfo: boolean,
+//                maxSamples?: number, recordSamples?: boolean)
+//
+// recordSamples keeps the raw sample stream (node id plus timestamp per
+// sample) for retrieval by stopProfilingTimestamped. A positive maxSamples
+// caps that stream via CpuProfilingOptions — it does not bound the
+// aggregated tree — and is only honored together with recordSamples, since
+// starting through CpuProfilingOptions records samples; on V8 versions
+// without that API the cap is ignored.
 NAN_METHOD(StartProfiling) {
-  if (info.Length() != 2) {
-    return Nan::ThrowTypeError("StartProfiling must have two arguments.");
+  if (info.Length() < 2 || info.Length() > 4) {
+    return Nan::ThrowTypeError(
+        "StartProfiling must have two to four arguments.");
   }
   if (!info[0]->IsString()) {
     return Nan::ThrowTypeError("First argument must be a string.");
@@ -263,34 +1074,74 @@ NAN_METHOD(StartProfiling) {
   if (!info[1]->IsBoolean()) {
     return Nan::ThrowTypeError("Second argument must be a boolean.");
   }
+  uint32_t maxSamples = 0;
+  if (info.Length() >= 3) {
+    if (!info[2]->IsNumber()) {
+      return Nan::ThrowTypeError("Third argument must be a number.");
+    }
+    maxSamples = Nan::To<uint32_t>(info[2]).FromJust();
+  }
+  bool recordSamples = false;
+  if (info.Length() == 4) {
+    if (!info[3]->IsBoolean()) {
+      return Nan::ThrowTypeError("Fourth argument must be a boolean.");
+    }
+    recordSamples =
+        Nan::MaybeLocal<Boolean>(info[3].As<Boolean>()).ToLocalChecked()
+            ->Value();
+  }
 
   Local<String> name =
       Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
-
-  // Sample counts and timestamps are not used, so we do not need to record
-  // samples.
-  const bool recordSamples = false;
+  ProfilerSessionStarted();
+  if (recordSamples) {
+    GetIsolateData()->timestampedSessionActive = true;
+  }
 
 // Line level accurate line information is not available in Node 11 or earlier.
 #if NODE_MODULE_VERSION > NODE_11_0_MODULE_VERSION
   bool includeLineInfo =
       Nan::MaybeLocal<Boolean>(info[1].As<Boolean>()).ToLocalChecked()->Value();
+// CpuProfilingOptions (and with it a per-session sample limit) is available
+// from V8 7.6. Starting through it implies sample recording, so this path
+// is reserved for sessions that asked for the sample stream.
+#if V8_MAJOR_VERSION > 7 || (V8_MAJOR_VERSION == 7 && V8_MINOR_VERSION >= 6)
+  if (recordSamples && maxSamples > 0) {
+    GetCpuProfiler()->StartProfiling(
+        name,
+        CpuProfilingOptions(includeLineInfo
+                                ? CpuProfilingMode::kCallerLineNumbers
+                                : CpuProfilingMode::kLeafNodeLineNumbers,
+                            maxSamples));
+    return;
+  }
+#endif
   if (includeLineInfo) {
-    cpuProfiler->StartProfiling(name, CpuProfilingMode::kCallerLineNumbers,
+    GetCpuProfiler()->StartProfiling(name, CpuProfilingMode::kCallerLineNumbers,
                                 recordSamples);
   } else {
-    cpuProfiler->StartProfiling(name, recordSamples);
+    GetCpuProfiler()->StartProfiling(name, recordSamples);
   }
 #else
-  cpuProfiler->StartProfiling(name, recordSamples);
+  GetCpuProfiler()->StartProfiling(name, recordSamples);
 #endif
 }
 
 // Signature:
-// stopProfiling(runName: string, includeLineInfo: boolean): TimeProfile
+// stopProfiling(runName: string, includeLineInfo: boolean,
+//               scriptFilter?: string, minHitCount?: number,
+//               maxDepth?: number): TimeProfile
+//
+// When scriptFilter is non-empty or minHitCount is positive, matching and
+// below-threshold subtrees are pruned during translation, before any JS
+// objects are created for them. A positive maxDepth truncates translated
+// stacks at that depth, folding deeper frames' hits into the node at the
+// cap. Neither can be combined with line-level profiles, and filtering and
+// depth capping are mutually exclusive.
 NAN_METHOD(StopProfiling) {
-  if (info.Length() != 2) {
-    return Nan::ThrowTypeError("StopProfling must have two arguments.");
+  if (info.Length() != 2 && info.Length() != 4 && info.Length() != 5) {
+    return Nan::ThrowTypeError(
+        "StopProfling must have two, four, or five arguments.");
   }
   if (!info[0]->IsString()) {
     return Nan::ThrowTypeError("First argument must be a string.");
@@ -298,18 +1149,896 @@ NAN_METHOD(StopProfiling) {
   if (!info[1]->IsBoolean()) {
     return Nan::ThrowTypeError("Second argument must be a boolean.");
   }
+  std::string scriptFilter;
+  uint32_t minHitCount = 0;
+  uint32_t maxDepth = 0;
+  if (info.Length() >= 4) {
+    if (!info[2]->IsString()) {
+      return Nan::ThrowTypeError("Third argument must be a string.");
+    }
+    if (!info[3]->IsNumber()) {
+      return Nan::ThrowTypeError("Fourth argument must be a number.");
+    }
+    Nan::Utf8String filter(info[2]);
+    scriptFilter = *filter != nullptr ? *filter : "";
+    minHitCount = Nan::To<uint32_t>(info[3]).FromJust();
+  }
+  if (info.Length() == 5) {
+    if (!info[4]->IsNumber()) {
+      return Nan::ThrowTypeError("Fifth argument must be a number.");
+    }
+    maxDepth = Nan::To<uint32_t>(info[4]).FromJust();
+  }
   Local<String> name =
       Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
   bool includeLineInfo =
       Nan::MaybeLocal<Boolean>(info[1].As<Boolean>()).ToLocalChecked()->Value();
+  bool filtering = !scriptFilter.empty() || minHitCount > 0;
+  if (includeLineInfo && (filtering || maxDepth > 0)) {
+    return Nan::ThrowTypeError(
+        "Filtering and depth capping cannot be combined with line-level "
+        "profiles.");
+  }
+  if (filtering && maxDepth > 0) {
+    return Nan::ThrowTypeError(
+        "Filtering and depth capping are mutually exclusive.");
+  }
 
-  CpuProfile* profile = cpuProfiler->StopProfiling(name);
+  IsolateData* data = GetIsolateData();
+  CpuProfile* profile = ProfilerSessionStopped(name);
   Local<Value> translated_profile =
-      TranslateTimeProfile(profile, includeLineInfo);
-  profile->Delete();
+      filtering
+          ? TranslateFilteredTimeProfile(data, profile, scriptFilter,
+                                         minHitCount)
+          : TranslateTimeProfile(data, profile, includeLineInfo, maxDepth);
+  DeleteCpuProfile(profile);
   info.GetReturnValue().Set(translated_profile);
 }
 
+// Plain C++ copy of a CpuProfileNode subtree, filled in on a worker thread
+// via the *Str accessors, which do not touch the JS heap.
+struct TimeProfileNodeData {
+  std::string name;
+  std::string scriptName;
+  int scriptId;
+  int lineNumber;
+  int columnNumber;
+  unsigned int hitCount;
+  std::vector<TimeProfileNodeData> children;
+};
+
+void ExtractTimeProfileNode(const CpuProfileNode* node,
+                            TimeProfileNodeData* data) {
+  const char* name = node->GetFunctionNameStr();
+  data->name = name != nullptr ? name : "";
+  const char* scriptName = node->GetScriptResourceNameStr();
+  data->scriptName = scriptName != nullptr ? scriptName : "";
+  data->scriptId = node->GetScriptId();
+  data->lineNumber = node->GetLineNumber();
+  data->columnNumber = node->GetColumnNumber();
+  data->hitCount = node->GetHitCount();
+  int32_t count = node->GetChildrenCount();
+  data->children.resize(count);
+  for (int32_t i = 0; i < count; i++) {
+    ExtractTimeProfileNode(node->GetChild(i), &data->children[i]);
+  }
+}
+
+Local<Object> TimeProfileNodeDataToObject(IsolateData* isolateData,
+                                          const TimeProfileNodeData& data) {
+  Local<Array> children = Nan::New<Array>(data.children.size());
+  for (size_t i = 0; i < data.children.size(); i++) {
+    Nan::Set(children, i,
+             TimeProfileNodeDataToObject(isolateData, data.children[i]));
+  }
+  return CreateTimeNode(isolateData,
+                        Nan::New<String>(data.name).ToLocalChecked(),
+                        Nan::New<String>(data.scriptName).ToLocalChecked(),
+                        Nan::New<Integer>(data.scriptId),
+                        Nan::New<Integer>(data.lineNumber),
+                        Nan::New<Integer>(data.columnNumber),
+                        Nan::New<Integer>(static_cast<int32_t>(data.hitCount)),
+                        children);
+}
+
+// Extracts a stopped CpuProfile into plain C++ data on a libuv worker thread,
+// so that the tree walk and string conversions do not block the event loop.
+// Only the final translation back to JS objects runs on the V8 thread.
+class StopProfilingWorker : public Nan::AsyncWorker {
+ public:
+  StopProfilingWorker(Nan::Callback* callback, CpuProfile* profile,
+                      std::string title)
+      : Nan::AsyncWorker(callback, "pprof:StopProfilingWorker"),
+        profile_(profile),
+        title_(std::move(title)) {}
+
+  void Execute() override {
+    ExtractTimeProfileNode(profile_->GetTopDownRoot(), &root_);
+    startTime_ = profile_->GetStartTime();
+    endTime_ = profile_->GetEndTime();
+  }
+
+  void HandleOKCallback() override {
+    Nan::HandleScope scope;
+    IsolateData* data = GetIsolateData();
+    DeleteCpuProfile(profile_);
+    profile_ = nullptr;
+    Local<Object> jsProfile = Nan::New<Object>();
+    Nan::Set(jsProfile, InternString(data, "title"),
+             Nan::New<String>(title_).ToLocalChecked());
+    Nan::Set(jsProfile, InternString(data, "topDownRoot"),
+             TimeProfileNodeDataToObject(data, root_));
+    Nan::Set(jsProfile, InternString(data, "startTime"),
+             Nan::New<Number>(startTime_));
+    Nan::Set(jsProfile, InternString(data, "endTime"),
+             Nan::New<Number>(endTime_));
+    Local<Value> argv[] = {Nan::Null(), jsProfile};
+    callback->Call(2, argv, async_resource);
+  }
+
+ private:
+  CpuProfile* profile_;
+  std::string title_;
+  TimeProfileNodeData root_;
+  int64_t startTime_;
+  int64_t endTime_;
+};
+
+// Continuous profiling keeps the CpuProfiler session running permanently and
+// rotates through generation-numbered runs: collecting a delta starts the
+// next generation before stopping the current one, so sampling never pauses
+// and V8 never tears down and rebuilds its code map between collections.
+
+Local<String> ContinuousRunName(int generation) {
+  return Nan::New<String>("pprof-continuous-" + std::to_string(generation))
+      .ToLocalChecked();
+}
+
+// Signature:
+// startContinuousProfiling()
+NAN_METHOD(StartContinuousProfiling) {
+  IsolateData* data = GetIsolateData();
+  if (data->continuousGeneration >= 0) {
+    return Nan::ThrowError("Continuous profiling is already started.");
+  }
+  data->continuousGeneration = 0;
+  ProfilerSessionStarted();
+  GetCpuProfiler()->StartProfiling(
+      ContinuousRunName(data->continuousGeneration), false);
+}
+
+// Signature:
+// collectContinuousDelta(): TimeProfile
+//
+// Returns a profile containing only the samples accumulated since
+// startContinuousProfiling or the previous collectContinuousDelta call.
+NAN_METHOD(CollectContinuousDelta) {
+  IsolateData* data = GetIsolateData();
+  if (data->continuousGeneration < 0) {
+    return Nan::ThrowError("Continuous profiling is not started.");
+  }
+  int generation = data->continuousGeneration++;
+  ProfilerSessionStarted();
+  GetCpuProfiler()->StartProfiling(
+      ContinuousRunName(data->continuousGeneration), false);
+  CpuProfile* profile =
+      ProfilerSessionStopped(ContinuousRunName(generation));
+  Local<Value> translated_profile = TranslateTimeProfile(data, profile, false);
+  DeleteCpuProfile(profile);
+  info.GetReturnValue().Set(translated_profile);
+}
+
+// Signature:
+// stopContinuousProfiling()
+NAN_METHOD(StopContinuousProfiling) {
+  IsolateData* data = GetIsolateData();
+  if (data->continuousGeneration < 0) {
+    return;
+  }
+  CpuProfile* profile = ProfilerSessionStopped(
+      ContinuousRunName(data->continuousGeneration));
+  DeleteCpuProfile(profile);
+  data->continuousGeneration = -1;
+}
+
+// Multi-cycle aggregation folds successive profiler runs into one merged
+// profile held natively (summed sample values, shared string table), so a
+// collector can upload one combined profile.proto per window instead of one
+// per cycle, without ever materializing the intermediate cycles as JS
+// objects.
+
+// Signature:
+// startAggregation(intervalMicros: number)
+NAN_METHOD(StartAggregation) {
+  if (info.Length() != 1 || !info[0]->IsNumber()) {
+    return Nan::ThrowTypeError("First argument must be a number.");
+  }
+  IsolateData* data = GetIsolateData();
+  if (data->timeAggregator) {
+    return Nan::ThrowError("Aggregation is already started.");
+  }
+  data->timeAggregator.reset(new pprof::TimeProfileAggregator(
+      Nan::To<int64_t>(info[0]).FromJust()));
+}
+
+// Signature:
+// aggregateProfile(runName: string)
+//
+// Stops the named profiler run and folds it into the merged profile.
+NAN_METHOD(AggregateProfile) {
+  if (info.Length() != 1 || !info[0]->IsString()) {
+    return Nan::ThrowTypeError("First argument must be a string.");
+  }
+  IsolateData* data = GetIsolateData();
+  if (!data->timeAggregator) {
+    return Nan::ThrowError("Aggregation is not started.");
+  }
+  Local<String> name =
+      Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
+  CpuProfile* profile = ProfilerSessionStopped(name);
+  data->timeAggregator->Add(profile);
+  DeleteCpuProfile(profile);
+}
+
+void FreeEncodedBuffer(char* data, void* hint) {
+  delete static_cast<std::vector<char>*>(hint);
+}
+
+// Wraps an encoded byte stream in a Buffer without copying: the vector is
+// moved to the heap and handed to the Buffer as externally-owned memory,
+// freed by the callback when the Buffer is collected. Multi-megabyte
+// profiles thus cross the boundary with zero copies and never count
+// against the JS heap.
+Local<Object> EncodedToBuffer(std::vector<char>&& encoded) {
+  std::vector<char>* owned = new std::vector<char>(std::move(encoded));
+  return Nan::NewBuffer(owned->data(), owned->size(), FreeEncodedBuffer,
+                        owned)
+      .ToLocalChecked();
+}
+
+// Signature:
+// flushAggregatedProfile(): Buffer
+//
+// Emits the merged profile as an uncompressed perftools.profiles.Profile
+// byte stream and resets the aggregator for the next window.
+NAN_METHOD(FlushAggregatedProfile) {
+  IsolateData* data = GetIsolateData();
+  if (!data->timeAggregator) {
+    return Nan::ThrowError("Aggregation is not started.");
+  }
+  info.GetReturnValue().Set(EncodedToBuffer(data->timeAggregator->Flush()));
+}
+
+// Signature:
+// stopAggregation()
+NAN_METHOD(StopAggregation) { GetIsolateData()->timeAggregator.reset(); }
+
+// Structure-of-arrays copy of a time profile: one entry per node, in
+// pre-order, with node 0 being the "(root)" node and parentIndex -1 for the
+// root. Strings are deduplicated into a single table so that the transfer to
+// JS is a handful of typed arrays instead of one object per node.
+struct FlatTimeProfile {
+  std::vector<int32_t> nameIndex;
+  std::vector<int32_t> scriptNameIndex;
+  std::vector<int32_t> scriptId;
+  std::vector<int32_t> lineNumber;
+  std::vector<int32_t> columnNumber;
+  std::vector<int32_t> hitCount;
+  std::vector<int32_t> parentIndex;
+  std::vector<std::string> stringTable;
+  std::unordered_map<std::string, int32_t> stringIds;
+
+  int32_t StringId(const char* str) {
+    std::string key = str != nullptr ? str : "";
+    auto it = stringIds.find(key);
+    if (it != stringIds.end()) return it->second;
+    int32_t id = stringTable.size();
+    stringTable.push_back(key);
+    stringIds.emplace(std::move(key), id);
+    return id;
+  }
+
+  void AddNode(const CpuProfileNode* node, int32_t parent) {
+    int32_t index = nameIndex.size();
+    nameIndex.push_back(StringId(node->GetFunctionNameStr()));
+    scriptNameIndex.push_back(StringId(node->GetScriptResourceNameStr()));
+    scriptId.push_back(node->GetScriptId());
+    lineNumber.push_back(node->GetLineNumber());
+    columnNumber.push_back(node->GetColumnNumber());
+    hitCount.push_back(node->GetHitCount());
+    parentIndex.push_back(parent);
+    int32_t count = node->GetChildrenCount();
+    for (int32_t i = 0; i < count; i++) {
+      AddNode(node->GetChild(i), index);
+    }
+  }
+};
+
+Local<Value> ToInt32Array(const std::vector<int32_t>& values) {
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(
+      Isolate::GetCurrent(), values.size() * sizeof(int32_t));
+  Local<Int32Array> array = Int32Array::New(buffer, 0, values.size());
+  Nan::TypedArrayContents<int32_t> contents(array);
+  std::copy(values.begin(), values.end(), *contents);
+  return array;
+}
+
+Local<Value> ToFloat64Array(const std::vector<double>& values) {
+  Local<ArrayBuffer> buffer = ArrayBuffer::New(
+      Isolate::GetCurrent(), values.size() * sizeof(double));
+  Local<Float64Array> array = Float64Array::New(buffer, 0, values.size());
+  Nan::TypedArrayContents<double> contents(array);
+  std::copy(values.begin(), values.end(), *contents);
+  return array;
+}
+
+// Signature:
+// stopProfilingFlat(runName: string): FlatTimeProfile
+//
+// Stops the profile and returns it as parallel typed arrays plus a string
+// table, avoiding the per-node JS object, children array, and boxed integer
+// allocations of the stopProfiling path.
+NAN_METHOD(StopProfilingFlat) {
+  if (info.Length() != 1) {
+    return Nan::ThrowTypeError("StopProfilingFlat must have one argument.");
+  }
+  if (!info[0]->IsString()) {
+    return Nan::ThrowTypeError("First argument must be a string.");
+  }
+  Local<String> name =
+      Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
+  IsolateData* data = GetIsolateData();
+  CpuProfile* profile = ProfilerSessionStopped(name);
+
+  FlatTimeProfile flat;
+  flat.AddNode(profile->GetTopDownRoot(), -1);
+  int64_t startTime = profile->GetStartTime();
+  int64_t endTime = profile->GetEndTime();
+  DeleteCpuProfile(profile);
+
+  Local<Array> stringTable = Nan::New<Array>(flat.stringTable.size());
+  for (size_t i = 0; i < flat.stringTable.size(); i++) {
+    Nan::Set(stringTable, i,
+             Nan::New<String>(flat.stringTable[i]).ToLocalChecked());
+  }
+
+  Local<Object> js_profile = Nan::New<Object>();
+  Nan::Set(js_profile, InternString(data, "stringTable"),
+           stringTable);
+  Nan::Set(js_profile, InternString(data, "nameIndex"),
+           ToInt32Array(flat.nameIndex));
+  Nan::Set(js_profile, InternString(data, "scriptNameIndex"),
+           ToInt32Array(flat.scriptNameIndex));
+  Nan::Set(js_profile, InternString(data, "scriptId"), ToInt32Array(flat.scriptId));
+  Nan::Set(js_profile, InternString(data, "lineNumber"),
+           ToInt32Array(flat.lineNumber));
+  Nan::Set(js_profile, InternString(data, "columnNumber"),
+           ToInt32Array(flat.columnNumber));
+  Nan::Set(js_profile, InternString(data, "hitCount"),
+           ToInt32Array(flat.hitCount));
+  Nan::Set(js_profile, InternString(data, "parentIndex"),
+           ToInt32Array(flat.parentIndex));
+  Nan::Set(js_profile, InternString(data, "startTime"),
+           Nan::New<Number>(startTime));
+  Nan::Set(js_profile, InternString(data, "endTime"),
+           Nan::New<Number>(endTime));
+  info.GetReturnValue().Set(js_profile);
+}
+
+#ifndef _WIN32
+// On-disk layout of a shared profile export (version 1): this header,
+// followed by the seven FlatTimeProfile int32 arrays back to back (nodeCount
+// entries each, pre-order, same meaning as in stopProfilingFlat), followed
+// by stringCount length-prefixed strings (uint32 byte length, then bytes).
+// sequence is incremented to an odd value before the payload is written and
+// to an even value after, so a reader that sees the same even value before
+// and after copying has a consistent snapshot.
+struct SharedProfileHeader {
+  uint32_t magic;  // 'ppfb', little-endian.
+  uint32_t version;
+  uint32_t sequence;
+  uint32_t nodeCount;
+  uint32_t stringCount;
+  uint32_t stringTableBytes;
+  double startTime;
+  double endTime;
+};
+
+const uint32_t kSharedProfileMagic = 0x62667070;  // 'ppfb'
+const uint32_t kSharedProfileVersion = 1;
+
+// Appends one int32 array to the mapping at offset; returns the new offset.
+size_t WriteInt32Array(char* base, size_t offset,
+                       const std::vector<int32_t>& values) {
+  size_t bytes = values.size() * sizeof(int32_t);
+  memcpy(base + offset, values.data(), bytes);
+  return offset + bytes;
+}
+#endif
+
+// Signature:
+// stopProfilingShared(runName: string, path: string): number
+//
+// Stops the profile and writes it, in the flat structure-of-arrays layout,
+// into a memory-mapped file that a sidecar process consumes. The serving
+// process does only the native tree copy and a memcpy; encoding,
+// compression, and upload happen in the sidecar, outside this process's CPU
+// budget. Returns the number of bytes written. The file is created on first
+// use, grown when a profile outgrows it, and its mapping is reused across
+// cycles.
+NAN_METHOD(StopProfilingShared) {
+#ifdef _WIN32
+  return Nan::ThrowError("stopProfilingShared is not supported on Windows.");
+#else
+  if (info.Length() != 2) {
+    return Nan::ThrowTypeError("StopProfilingShared must have two arguments.");
+  }
+  if (!info[0]->IsString()) {
+    return Nan::ThrowTypeError("First argument must be a string.");
+  }
+  if (!info[1]->IsString()) {
+    return Nan::ThrowTypeError("Second argument must be a string.");
+  }
+  Local<String> name =
+      Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
+  Nan::Utf8String pathStr(info[1]);
+  std::string path = *pathStr != nullptr ? *pathStr : "";
+
+  CpuProfile* profile = ProfilerSessionStopped(name);
+  FlatTimeProfile flat;
+  flat.AddNode(profile->GetTopDownRoot(), -1);
+  int64_t startTime = profile->GetStartTime();
+  int64_t endTime = profile->GetEndTime();
+  DeleteCpuProfile(profile);
+
+  size_t stringTableBytes = 0;
+  for (const std::string& str : flat.stringTable) {
+    stringTableBytes += sizeof(uint32_t) + str.size();
+  }
+  size_t totalBytes = sizeof(SharedProfileHeader) +
+                      7 * sizeof(int32_t) * flat.nameIndex.size() +
+                      stringTableBytes;
+
+  IsolateData* data = GetIsolateData();
+  if (data->sharedExportBase != nullptr &&
+      (data->sharedExportPath != path || data->sharedExportSize < totalBytes)) {
+    munmap(data->sharedExportBase, data->sharedExportSize);
+    close(data->sharedExportFd);
+    data->sharedExportBase = nullptr;
+    data->sharedExportFd = -1;
+    data->sharedExportSize = 0;
+  }
+  if (data->sharedExportBase == nullptr) {
+    int fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      return Nan::ThrowError("Failed to open shared profile file.");
+    }
+    if (ftruncate(fd, totalBytes) != 0) {
+      close(fd);
+      return Nan::ThrowError("Failed to size shared profile file.");
+    }
+    void* base =
+        mmap(nullptr, totalBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+      close(fd);
+      return Nan::ThrowError("Failed to map shared profile file.");
+    }
+    data->sharedExportFd = fd;
+    data->sharedExportBase = base;
+    data->sharedExportSize = totalBytes;
+    data->sharedExportPath = path;
+  }
+
+  char* base = static_cast<char*>(data->sharedExportBase);
+  SharedProfileHeader* header = reinterpret_cast<SharedProfileHeader*>(base);
+  // Seqlock write: odd sequence while the payload is inconsistent.
+  header->sequence = ++data->sharedExportSequence;
+  std::atomic_thread_fence(std::memory_order_release);
+
+  header->magic = kSharedProfileMagic;
+  header->version = kSharedProfileVersion;
+  header->nodeCount = static_cast<uint32_t>(flat.nameIndex.size());
+  header->stringCount = static_cast<uint32_t>(flat.stringTable.size());
+  header->stringTableBytes = static_cast<uint32_t>(stringTableBytes);
+  header->startTime = static_cast<double>(startTime);
+  header->endTime = static_cast<double>(endTime);
+
+  size_t offset = sizeof(SharedProfileHeader);
+  offset = WriteInt32Array(base, offset, flat.nameIndex);
+  offset = WriteInt32Array(base, offset, flat.scriptNameIndex);
+  offset = WriteInt32Array(base, offset, flat.scriptId);
+  offset = WriteInt32Array(base, offset, flat.lineNumber);
+  offset = WriteInt32Array(base, offset, flat.columnNumber);
+  offset = WriteInt32Array(base, offset, flat.hitCount);
+  offset = WriteInt32Array(base, offset, flat.parentIndex);
+  for (const std::string& str : flat.stringTable) {
+    uint32_t length = static_cast<uint32_t>(str.size());
+    memcpy(base + offset, &length, sizeof(length));
+    offset += sizeof(length);
+    memcpy(base + offset, str.data(), str.size());
+    offset += str.size();
+  }
+
+  std::atomic_thread_fence(std::memory_order_release);
+  header->sequence = ++data->sharedExportSequence;
+
+  info.GetReturnValue().Set(
+      Nan::New<Number>(static_cast<double>(totalBytes)));
+#endif
+}
+
+// Wall time in microseconds since epoch. Label ranges are stamped with it,
+// and stopProfilingTimestamped rebases V8's monotonic sample timestamps
+// onto the same base before matching samples to ranges, so the two are
+// directly comparable.
+double NowMicros() {
+  return static_cast<double>(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count());
+}
+
+// Closes the currently open label range, if any.
+void CloseOpenLabelRange(IsolateData* data, double nowMicros) {
+  if (!data->labelRanges.empty() && data->labelRanges.back().endMicros == 0) {
+    data->labelRanges.back().endMicros = nowMicros;
+  }
+}
+
+// Signature:
+// setLabels(labels: {[key: string]: string})
+//
+// Registers a label set (e.g. a route name) as current from now on; samples
+// collected in timestamped mode while it is current are attributed to it by
+// timestamp. Replaces any previously current label set. Identical sets are
+// interned so per-request registration is cheap.
+NAN_METHOD(SetLabels) {
+  if (info.Length() != 1 || !info[0]->IsObject()) {
+    return Nan::ThrowTypeError("First argument must be an object.");
+  }
+  Local<Object> js_labels = info[0].As<Object>();
+  Local<Array> names = Nan::GetOwnPropertyNames(js_labels).ToLocalChecked();
+  std::vector<std::pair<std::string, std::string>> labels;
+  std::string internKey;
+  for (uint32_t i = 0; i < names->Length(); i++) {
+    Local<Value> name = Nan::Get(names, i).ToLocalChecked();
+    Local<Value> value = Nan::Get(js_labels, name).ToLocalChecked();
+    Nan::Utf8String nameStr(name);
+    Nan::Utf8String valueStr(value);
+    labels.emplace_back(*nameStr != nullptr ? *nameStr : "",
+                        *valueStr != nullptr ? *valueStr : "");
+    internKey += labels.back().first;
+    internKey += '\0';
+    internKey += labels.back().second;
+    internKey += '\0';
+  }
+
+  IsolateData* data = GetIsolateData();
+  // Without a timestamped session there is no consumer for closed ranges,
+  // and setLabels is typically called per request; retaining them would grow
+  // these vectors for the life of the isolate. Keep only the range opened
+  // below.
+  if (!data->timestampedSessionActive) {
+    data->labelRanges.clear();
+    data->labelSets.clear();
+    data->labelSetIds.clear();
+  }
+  size_t labelSetIndex;
+  auto it = data->labelSetIds.find(internKey);
+  if (it != data->labelSetIds.end()) {
+    labelSetIndex = it->second;
+  } else {
+    labelSetIndex = data->labelSets.size();
+    data->labelSets.push_back(std::move(labels));
+    data->labelSetIds.emplace(internKey, labelSetIndex);
+  }
+
+  double now = NowMicros();
+  CloseOpenLabelRange(data, now);
+  data->labelRanges.push_back({now, 0, labelSetIndex});
+}
+
+// Signature:
+// clearLabels()
+//
+// Marks the current label set as no longer applying; subsequent samples are
+// unlabeled until the next setLabels call.
+NAN_METHOD(ClearLabels) {
+  CloseOpenLabelRange(GetIsolateData(), NowMicros());
+}
+
+// Monotonic time in microseconds, for measuring GC pause durations. Pauses
+// are intervals, not timestamps, so the steady clock is used rather than the
+// wall clock NowMicros reads.
+int64_t SteadyNowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+// GC prologue/epilogue callbacks run on the V8 thread with the world
+// stopped, so the pair brackets the full pause for the collection.
+NAN_GC_CALLBACK(GCPauseBegin) {
+  IsolateData* data = GetIsolateData();
+  if (data->gcTracking) {
+    data->gcPauseStartMicros = SteadyNowMicros();
+  }
+}
+
+NAN_GC_CALLBACK(GCPauseEnd) {
+  IsolateData* data = GetIsolateData();
+  if (data->gcTracking && data->gcPauseStartMicros != 0) {
+    data->gcPauseTotalMicros += SteadyNowMicros() - data->gcPauseStartMicros;
+    data->gcPauseStartMicros = 0;
+    data->gcCount++;
+  }
+}
+
+// Signature:
+// startGcTracking()
+//
+// Starts accumulating GC pause time for the current isolate. The CPU profile
+// already shows "(garbage collector)" samples, but sample counts understate
+// stalls: a 40ms major collection may catch one sample. Bracketing each
+// collection with prologue/epilogue callbacks measures the pauses
+// themselves, so GC stall time can be reported alongside the profile
+// instead of being correlated by hand from separate tooling.
+NAN_METHOD(StartGcTracking) {
+  IsolateData* data = GetIsolateData();
+  if (!data->gcCallbacksInstalled) {
+    Nan::AddGCPrologueCallback(GCPauseBegin);
+    Nan::AddGCEpilogueCallback(GCPauseEnd);
+    data->gcCallbacksInstalled = true;
+  }
+  data->gcPauseStartMicros = 0;
+  data->gcPauseTotalMicros = 0;
+  data->gcCount = 0;
+  data->gcTracking = true;
+}
+
+// Signature:
+// stopGcTracking(): {gcPauseMicros: number, gcCount: number}
+//
+// Stops accumulating and returns the total GC pause time and the number of
+// collections observed since startGcTracking.
+NAN_METHOD(StopGcTracking) {
+  IsolateData* data = GetIsolateData();
+  data->gcTracking = false;
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, InternString(data, "gcPauseMicros"),
+           Nan::New<Number>(static_cast<double>(data->gcPauseTotalMicros)));
+  Nan::Set(result, InternString(data, "gcCount"),
+           Nan::New<Number>(static_cast<double>(data->gcCount)));
+  info.GetReturnValue().Set(result);
+}
+
+// Signature:
+// stopProfilingTimestamped(runName: string): TimestampedTimeProfile
+//
+// Stops a profile started with recordSamples and returns the usual profile
+// tree (with a nodeId on every node) together with the raw sample stream as
+// two parallel typed arrays: the sampled node's id and the sample's
+// timestamp in microseconds since epoch. The stream crosses the native
+// boundary as typed arrays rather than per-sample objects, which would be
+// prohibitive at millisecond sampling intervals.
+NAN_METHOD(StopProfilingTimestamped) {
+  if (info.Length() != 1 || !info[0]->IsString()) {
+    return Nan::ThrowTypeError("First argument must be a string.");
+  }
+  Local<String> name =
+      Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
+  CpuProfile* profile = ProfilerSessionStopped(name);
+
+  IsolateData* data = GetIsolateData();
+  int count = profile->GetSamplesCount();
+  std::vector<int32_t> nodeIds(count);
+  std::vector<double> timestamps(count);
+  std::vector<int32_t> labelIndexes(count);
+  // Sample timestamps (like GetStartTime/GetEndTime) are on V8's monotonic
+  // time base, whose origin is unspecified. Profiling has just stopped, so
+  // the wall clock read here and the profile's end time denote the same
+  // instant; their difference rebases every sample timestamp to
+  // microseconds since epoch without assuming V8's monotonic base is
+  // shared with any C++ clock.
+  double epochOffsetMicros =
+      NowMicros() - static_cast<double>(profile->GetEndTime());
+  // Samples and label ranges are both chronological, so attribution is a
+  // single merge pass.
+  size_t rangeIndex = 0;
+  for (int i = 0; i < count; i++) {
+    nodeIds[i] = static_cast<int32_t>(profile->GetSample(i)->GetNodeId());
+    // The rebased (epoch) timestamp is also what label ranges are matched
+    // against: ranges are stamped with the wall clock by setLabels, so the
+    // raw monotonic value would compare ranges and samples on different
+    // clocks and never match.
+    double timestamp =
+        static_cast<double>(profile->GetSampleTimestamp(i)) +
+        epochOffsetMicros;
+    timestamps[i] = timestamp;
+    while (rangeIndex < data->labelRanges.size() &&
+           data->labelRanges[rangeIndex].endMicros != 0 &&
+           data->labelRanges[rangeIndex].endMicros <= timestamp) {
+      rangeIndex++;
+    }
+    labelIndexes[i] =
+        rangeIndex < data->labelRanges.size() &&
+                data->labelRanges[rangeIndex].startMicros <= timestamp
+            ? static_cast<int32_t>(data->labelRanges[rangeIndex].labelSetIndex)
+            : -1;
+  }
+
+  Local<Array> js_labelSets = Nan::New<Array>(data->labelSets.size());
+  for (size_t i = 0; i < data->labelSets.size(); i++) {
+    Local<Object> js_set = Nan::New<Object>();
+    for (const auto& label : data->labelSets[i]) {
+      Nan::Set(js_set, InternString(data, label.first.c_str()),
+               Nan::New<String>(label.second).ToLocalChecked());
+    }
+    Nan::Set(js_labelSets, i, js_set);
+  }
+
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, InternString(data, "profile"),
+           TranslateTimeProfile(data, profile, false, 0, true));
+  Nan::Set(result, InternString(data, "sampleNodeIds"), ToInt32Array(nodeIds));
+  Nan::Set(result, InternString(data, "sampleTimestamps"),
+           ToFloat64Array(timestamps));
+  Nan::Set(result, InternString(data, "sampleLabelIndex"),
+           ToInt32Array(labelIndexes));
+  Nan::Set(result, InternString(data, "labelSets"), js_labelSets);
+  DeleteCpuProfile(profile);
+
+  // Consumed ranges are dropped; an open range survives into the next
+  // session so a long-running request keeps its labels.
+  bool openRange =
+      !data->labelRanges.empty() && data->labelRanges.back().endMicros == 0;
+  IsolateData::LabelRange continuing{};
+  std::vector<std::pair<std::string, std::string>> continuingSet;
+  if (openRange) {
+    continuing = data->labelRanges.back();
+    continuingSet = data->labelSets[continuing.labelSetIndex];
+  }
+  data->labelRanges.clear();
+  data->labelSets.clear();
+  data->labelSetIds.clear();
+  if (openRange) {
+    data->labelSets.push_back(continuingSet);
+    data->labelRanges.push_back({continuing.startMicros, 0, 0});
+  }
+  data->timestampedSessionActive = false;
+
+  info.GetReturnValue().Set(result);
+}
+
+// Signature:
+// stopProfilingAsync(runName: string,
+//                    callback: (err: Error|null, profile?) => void)
+//
+// Asynchronous variant of stopProfiling. Line-level profiles are not
+// supported; the caller is expected to have started the profile without
+// line information.
+NAN_METHOD(StopProfilingAsync) {
+  if (info.Length() != 2) {
+    return Nan::ThrowTypeError("StopProfilingAsync must have two arguments.");
+  }
+  if (!info[0]->IsString()) {
+    return Nan::ThrowTypeError("First argument must be a string.");
+  }
+  if (!info[1]->IsFunction()) {
+    return Nan::ThrowTypeError("Second argument must be a function.");
+  }
+  Local<String> name =
+      Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
+  CpuProfile* profile = ProfilerSessionStopped(name);
+  Nan::Callback* callback = new Nan::Callback(info[1].As<Function>());
+  Nan::AsyncQueueWorker(new StopProfilingWorker(
+      callback, profile, *Nan::Utf8String(name)));
+}
+
+// Serializes a stopped CpuProfile to profile.proto bytes and gzips the
+// result in one pass on a libuv worker thread, so neither encoding nor
+// compression competes with the event loop.
+class EncodeProfileWorker : public Nan::AsyncWorker {
+ public:
+  EncodeProfileWorker(Nan::Callback* callback, CpuProfile* profile,
+                      int64_t intervalMicros)
+      : Nan::AsyncWorker(callback, "pprof:EncodeProfileWorker"),
+        profile_(profile),
+        intervalMicros_(intervalMicros) {}
+
+  void Execute() override {
+    std::vector<char> encoded =
+        pprof::EncodeTimeProfile(profile_, intervalMicros_);
+    if (!pprof::CompressGzip(encoded, &compressed_)) {
+      SetErrorMessage("gzip compression of profile failed");
+    }
+  }
+
+  void HandleOKCallback() override {
+    Nan::HandleScope scope;
+    DeleteCpuProfile(profile_);
+    profile_ = nullptr;
+    Local<Value> argv[] = {Nan::Null(),
+                           EncodedToBuffer(std::move(compressed_))};
+    callback->Call(2, argv, async_resource);
+  }
+
+  void HandleErrorCallback() override {
+    Nan::HandleScope scope;
+    DeleteCpuProfile(profile_);
+    profile_ = nullptr;
+    Nan::AsyncWorker::HandleErrorCallback();
+  }
+
+ private:
+  CpuProfile* profile_;
+  int64_t intervalMicros_;
+  std::vector<char> compressed_;
+};
+
+// Signature:
+// stopProfilingEncoded(runName: string, intervalMicros: number,
+//                      callback: (err: Error|null, buffer?: Buffer) => void)
+//
+// Stops the profile and hands back a gzipped profile.proto byte stream,
+// with both serialization and compression performed off the main thread.
+NAN_METHOD(StopProfilingEncoded) {
+  if (info.Length() != 3) {
+    return Nan::ThrowTypeError(
+        "StopProfilingEncoded must have three arguments.");
+  }
+  if (!info[0]->IsString()) {
+    return Nan::ThrowTypeError("First argument must be a string.");
+  }
+  if (!info[1]->IsNumber()) {
+    return Nan::ThrowTypeError("Second argument must be a number.");
+  }
+  if (!info[2]->IsFunction()) {
+    return Nan::ThrowTypeError("Third argument must be a function.");
+  }
+  Local<String> name =
+      Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
+#if NODE_MODULE_VERSION > NODE_8_0_MODULE_VERSION
+  int64_t intervalMicros = info[1].As<Integer>()->Value();
+#else
+  int64_t intervalMicros = info[1].As<Integer>()->IntegerValue();
+#endif
+  CpuProfile* profile = ProfilerSessionStopped(name);
+  Nan::Callback* callback = new Nan::Callback(info[2].As<Function>());
+  Nan::AsyncQueueWorker(
+      new EncodeProfileWorker(callback, profile, intervalMicros));
+}
+
+// Signature:
+// stopProfilingProto(runName: string, intervalMicros: number): Buffer
+//
+// Stops the profile and serializes it directly to a perftools.profiles.Profile
+// byte stream, without materializing a JS object per profile node. The
+// returned buffer is the uncompressed profile.proto message.
+NAN_METHOD(StopProfilingProto) {
+  if (info.Length() != 2) {
+    return Nan::ThrowTypeError("StopProfilingProto must have two arguments.");
+  }
+  if (!info[0]->IsString()) {
+    return Nan::ThrowTypeError("First argument must be a string.");
+  }
+  if (!info[1]->IsNumber()) {
+    return Nan::ThrowTypeError("Second argument must be a number.");
+  }
+  Local<String> name =
+      Nan::MaybeLocal<String>(info[0].As<String>()).ToLocalChecked();
+#if NODE_MODULE_VERSION > NODE_8_0_MODULE_VERSION
+  int64_t intervalMicros = info[1].As<Integer>()->Value();
+#else
+  int64_t intervalMicros = info[1].As<Integer>()->IntegerValue();
+#endif
+
+  CpuProfile* profile = ProfilerSessionStopped(name);
+  std::vector<char> encoded = pprof::EncodeTimeProfile(profile, intervalMicros);
+  DeleteCpuProfile(profile);
+  info.GetReturnValue().Set(EncodedToBuffer(std::move(encoded)));
+}
+
 // Signature:
 // setSamplingInterval(intervalMicros: number)
 NAN_METHOD(SetSamplingInterval) {
@@ -318,7 +2047,7 @@ NAN_METHOD(SetSamplingInterval) {
 #else
   int us = info[0].As<Integer>()->IntegerValue();
 #endif
-  cpuProfiler->SetSamplingInterval(us);
+  GetCpuProfiler()->SetSamplingInterval(us);
 }
 
 NAN_MODULE_INIT(InitAll) {
@@ -329,6 +2058,60 @@ NAN_MODULE_INIT(InitAll) {
   Nan::Set(timeProfiler, Nan::New("stopProfiling").ToLocalChecked(),
            Nan::GetFunction(Nan::New<FunctionTemplate>(StopProfiling))
                .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("startContinuousProfiling").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<FunctionTemplate>(StartContinuousProfiling))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("collectContinuousDelta").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(CollectContinuousDelta))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopContinuousProfiling").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<FunctionTemplate>(StopContinuousProfiling))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("startAggregation").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StartAggregation))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("aggregateProfile").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(AggregateProfile))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("flushAggregatedProfile").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(FlushAggregatedProfile))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopAggregation").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StopAggregation))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopProfilingFlat").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StopProfilingFlat))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopProfilingTimestamped").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<FunctionTemplate>(StopProfilingTimestamped))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopProfilingAsync").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StopProfilingAsync))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopProfilingEncoded").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StopProfilingEncoded))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopProfilingProto").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StopProfilingProto))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("setLabels").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(SetLabels))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("clearLabels").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(ClearLabels))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopProfilingShared").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StopProfilingShared))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("startGcTracking").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StartGcTracking))
+               .ToLocalChecked());
+  Nan::Set(timeProfiler, Nan::New("stopGcTracking").ToLocalChecked(),
+           Nan::GetFunction(Nan::New<FunctionTemplate>(StopGcTracking))
+               .ToLocalChecked());
   Nan::Set(timeProfiler, Nan::New("setSamplingInterval").ToLocalChecked(),
            Nan::GetFunction(Nan::New<FunctionTemplate>(SetSamplingInterval))
                .ToLocalChecked());
@@ -344,11 +2127,36 @@ NAN_MODULE_INIT(InitAll) {
       heapProfiler, Nan::New("stopSamplingHeapProfiler").ToLocalChecked(),
       Nan::GetFunction(Nan::New<FunctionTemplate>(StopSamplingHeapProfiler))
           .ToLocalChecked());
+  Nan::Set(
+      heapProfiler, Nan::New("pauseSamplingHeapProfiler").ToLocalChecked(),
+      Nan::GetFunction(Nan::New<FunctionTemplate>(PauseSamplingHeapProfiler))
+          .ToLocalChecked());
+  Nan::Set(
+      heapProfiler, Nan::New("resumeSamplingHeapProfiler").ToLocalChecked(),
+      Nan::GetFunction(Nan::New<FunctionTemplate>(ResumeSamplingHeapProfiler))
+          .ToLocalChecked());
   Nan::Set(heapProfiler, Nan::New("getAllocationProfile").ToLocalChecked(),
            Nan::GetFunction(Nan::New<FunctionTemplate>(GetAllocationProfile))
                .ToLocalChecked());
+  Nan::Set(heapProfiler,
+           Nan::New("getAllocationProfileAsync").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<FunctionTemplate>(GetAllocationProfileAsync))
+               .ToLocalChecked());
+  Nan::Set(heapProfiler,
+           Nan::New("getAllocationProfileDelta").ToLocalChecked(),
+           Nan::GetFunction(
+               Nan::New<FunctionTemplate>(GetAllocationProfileDelta))
+               .ToLocalChecked());
   Nan::Set(target, Nan::New<String>("heapProfiler").ToLocalChecked(),
            heapProfiler);
 }
 
+// Workers load the same shared object as the main thread, so registration
+// must be worker-enabled where nan supports it; per-isolate state is kept in
+// IsolateData above.
+#ifdef NAN_MODULE_WORKER_ENABLED
+NAN_MODULE_WORKER_ENABLED(google_cloud_profiler, InitAll)
+#else
 NODE_MODULE(google_cloud_profiler, InitAll);
+#endif
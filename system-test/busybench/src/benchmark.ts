@@ -0,0 +1,212 @@
+/**
+ * Copyright 2020 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Profiler-overhead benchmark built on the busybench workload.
+ *
+ * Runs the same busy loop with profiling off, with time profiling on, and
+ * with heap profiling on, and reports per-mode throughput, p99 event-loop
+ * lag, and per-cycle stop/serialize/encode durations as JSON on stdout.
+ * Exits non-zero if the overhead of a profiling mode relative to the
+ * baseline exceeds the configured thresholds.
+ *
+ * Usage:
+ *   node benchmark.js [durationSeconds] [maxThroughputDropPercent] \
+ *       [maxP99LagIncreaseMillis]
+ */
+
+import {encodeSync, heap, time} from 'pprof';
+
+const durationSeconds = Number(process.argv.length > 2 ? process.argv[2] : 30);
+const maxThroughputDropPercent =
+    Number(process.argv.length > 3 ? process.argv[3] : 10);
+const maxP99LagIncreaseMillis =
+    Number(process.argv.length > 4 ? process.argv[4] : 10);
+
+const PROFILE_CYCLE_SECONDS = 10;
+const LAG_SAMPLE_INTERVAL_MILLIS = 10;
+
+interface CycleTimings {
+  stopMillis: number;
+  serializeMillis: number;
+  encodeMillis: number;
+}
+
+interface ModeResult {
+  mode: string;
+  iterations: number;
+  iterationsPerSecond: number;
+  p99EventLoopLagMillis: number;
+  cycles: CycleTimings[];
+}
+
+function percentile(sorted: number[], p: number): number {
+  if (sorted.length === 0) return 0;
+  const idx = Math.min(
+      sorted.length - 1, Math.ceil((p / 100) * sorted.length) - 1);
+  return sorted[Math.max(0, idx)];
+}
+
+/** Runs the busybench workload for durationSeconds, returning the number of
+ * completed iterations and observed event-loop lag samples. */
+function runWorkload(durationSeconds: number):
+    Promise<{iterations: number, lagSamples: number[]}> {
+  return new Promise(resolve => {
+    const testArr: number[][] = [];
+    // Allocate 16 MiB in 64 KiB chunks.
+    for (let i = 0; i < 16 * 16; i++) {
+      testArr[i] = new Array<number>(64 * 1024);
+    }
+    const startTime = Date.now();
+    let iterations = 0;
+    const lagSamples: number[] = [];
+
+    let lastTick = Date.now();
+    const lagTimer = setInterval(() => {
+      const now = Date.now();
+      lagSamples.push(Math.max(0, now - lastTick - LAG_SAMPLE_INTERVAL_MILLIS));
+      lastTick = now;
+    }, LAG_SAMPLE_INTERVAL_MILLIS);
+
+    function busyLoop() {
+      for (let i = 0; i < testArr.length; i++) {
+        for (let j = 0; j < testArr[i].length; j++) {
+          testArr[i][j] = Math.sqrt(j * testArr[i][j]);
+        }
+      }
+      iterations++;
+      if (Date.now() - startTime < 1000 * durationSeconds) {
+        setTimeout(busyLoop, 5);
+      } else {
+        clearInterval(lagTimer);
+        resolve({iterations, lagSamples});
+      }
+    }
+    busyLoop();
+  });
+}
+
+type StopFunction = ReturnType<typeof time.start>;
+
+/** Collects one time profile cycle, timing the stop (which includes
+ * serialization for the time profiler) and encode stages separately. */
+function collectTimeProfileCycle(stop: StopFunction): CycleTimings {
+  const stopStart = process.hrtime();
+  const profile = stop();
+  const stopElapsed = process.hrtime(stopStart);
+  const encodeStart = process.hrtime();
+  encodeSync(profile);
+  const encodeElapsed = process.hrtime(encodeStart);
+  return {
+    stopMillis: stopElapsed[0] * 1e3 + stopElapsed[1] / 1e6,
+    // The time profiler serializes within stop(); reported separately as 0.
+    serializeMillis: 0,
+    encodeMillis: encodeElapsed[0] * 1e3 + encodeElapsed[1] / 1e6,
+  };
+}
+
+async function runMode(mode: 'off'|'time'|'heap'): Promise<ModeResult> {
+  const cycles: CycleTimings[] = [];
+  let stopTime: StopFunction|null = null;
+  if (mode === 'time') {
+    stopTime = time.start(1000);
+  } else if (mode === 'heap') {
+    heap.start(512 * 1024, 64);
+  }
+
+  const cycleTimer = setInterval(() => {
+    if (mode === 'time' && stopTime) {
+      cycles.push(collectTimeProfileCycle(stopTime));
+      stopTime = time.start(1000);
+    } else if (mode === 'heap') {
+      const stopStart = process.hrtime();
+      const v8Profile = heap.v8Profile();
+      const stopElapsed = process.hrtime(stopStart);
+      const serializeStart = process.hrtime();
+      const profile = heap.profile();
+      const serializeElapsed = process.hrtime(serializeStart);
+      const encodeStart = process.hrtime();
+      encodeSync(profile);
+      const encodeElapsed = process.hrtime(encodeStart);
+      // Reference v8Profile so the extraction cost above is not elided.
+      if (v8Profile.children.length < 0) throw new Error('unreachable');
+      cycles.push({
+        stopMillis: stopElapsed[0] * 1e3 + stopElapsed[1] / 1e6,
+        serializeMillis: serializeElapsed[0] * 1e3 + serializeElapsed[1] / 1e6,
+        encodeMillis: encodeElapsed[0] * 1e3 + encodeElapsed[1] / 1e6,
+      });
+    }
+  }, PROFILE_CYCLE_SECONDS * 1000);
+
+  const {iterations, lagSamples} = await runWorkload(durationSeconds);
+
+  clearInterval(cycleTimer);
+  if (mode === 'time' && stopTime) {
+    stopTime();
+  } else if (mode === 'heap') {
+    heap.stop();
+  }
+
+  lagSamples.sort((a, b) => a - b);
+  return {
+    mode,
+    iterations,
+    iterationsPerSecond: iterations / durationSeconds,
+    p99EventLoopLagMillis: percentile(lagSamples, 99),
+    cycles,
+  };
+}
+
+async function main(): Promise<void> {
+  const results: ModeResult[] = [];
+  for (const mode of ['off', 'time', 'heap'] as const) {
+    results.push(await runMode(mode));
+  }
+  const baseline = results[0];
+
+  const failures: string[] = [];
+  for (const result of results.slice(1)) {
+    const throughputDropPercent = 100 *
+        (baseline.iterationsPerSecond - result.iterationsPerSecond) /
+        baseline.iterationsPerSecond;
+    const lagIncreaseMillis =
+        result.p99EventLoopLagMillis - baseline.p99EventLoopLagMillis;
+    if (throughputDropPercent > maxThroughputDropPercent) {
+      failures.push(`${result.mode}: throughput drop ${
+          throughputDropPercent.toFixed(1)}% exceeds ${
+          maxThroughputDropPercent}%`);
+    }
+    if (lagIncreaseMillis > maxP99LagIncreaseMillis) {
+      failures.push(`${result.mode}: p99 lag increase ${
+          lagIncreaseMillis.toFixed(1)}ms exceeds ${
+          maxP99LagIncreaseMillis}ms`);
+    }
+  }
+
+  console.log(JSON.stringify(
+      {
+        durationSeconds,
+        thresholds: {maxThroughputDropPercent, maxP99LagIncreaseMillis},
+        results,
+        failures,
+      },
+      null, 2));
+  if (failures.length > 0) {
+    process.exitCode = 1;
+  }
+}
+
+main();
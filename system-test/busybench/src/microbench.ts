@@ -0,0 +1,269 @@
+/**
+ * Copyright 2020 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+ * Serialization and encoding micro-benchmark over synthetic profile trees.
+ *
+ * Generates parameterized TimeProfile and AllocationProfileNode trees
+ * (node count, depth, and string cardinality are configurable, optionally
+ * serialized through a SourceMapper) at production scale, times the
+ * serialize and encode stages separately, and reports ops/sec, ms/op, and
+ * retained heap per op as JSON on stdout. Run with --expose-gc for
+ * meaningful per-op heap numbers. The native translation stage consumes
+ * V8-internal CpuProfile objects and cannot be driven from synthetic
+ * trees; it is timed against a short real profiling run here (and under a
+ * sustained workload by benchmark.js).
+ *
+ * Usage:
+ *   node --expose-gc microbench.js [nodeCount] [maxDepth] \
+ *       [stringCardinality] [iterations] [useSourceMapper]
+ */
+
+import {
+  AllocationProfileNode,
+  encodeSync,
+  serializeHeapProfile,
+  serializeTimeProfile,
+  SourceMapper,
+  time,
+  TimeProfile,
+  TimeProfileNode,
+} from 'pprof';
+
+const nodeCount = Number(process.argv.length > 2 ? process.argv[2] : 10000);
+const maxDepth = Number(process.argv.length > 3 ? process.argv[3] : 32);
+const stringCardinality =
+    Number(process.argv.length > 4 ? process.argv[4] : 2000);
+const iterations = Number(process.argv.length > 5 ? process.argv[5] : 20);
+const useSourceMapper = process.argv.length > 6 && process.argv[6] === '1';
+
+const BENCH_INTERVAL_MICROS = 1000;
+const BENCH_INTERVAL_BYTES = 512 * 1024;
+const WARMUP_ITERATIONS = 3;
+
+interface StageResult {
+  stage: string;
+  iterations: number;
+  opsPerSecond: number;
+  millisPerOp: number;
+  /** Retained heap growth per op; only meaningful under --expose-gc. */
+  heapBytesPerOp: number;
+}
+
+/** Deterministic pseudo-random generator so runs are comparable. */
+function makeRandom(seed: number): () => number {
+  let state = seed;
+  return () => {
+    state = (state * 1103515245 + 12345) % 0x80000000;
+    return state / 0x80000000;
+  };
+}
+
+function buildStrings(prefix: string, count: number): string[] {
+  const strings: string[] = [];
+  for (let i = 0; i < count; i++) {
+    strings.push(`${prefix}-${i}`);
+  }
+  return strings;
+}
+
+/** Builds a tree of count nodes no deeper than depth: nodes are appended to
+ * a breadth-first frontier, each getting a bounded random fan-out, so shape
+ * approximates a real profile (wide near the root, ragged below). */
+function synthesizeTimeProfile(
+    count: number, depth: number, cardinality: number): TimeProfile {
+  const random = makeRandom(17);
+  const names = buildStrings('function', cardinality);
+  const scripts = buildStrings('/srv/bundle/script', cardinality);
+  const root: TimeProfileNode = {
+    name: '(root)',
+    scriptName: '',
+    scriptId: 0,
+    lineNumber: 0,
+    columnNumber: 0,
+    hitCount: 0,
+    children: [],
+  };
+  const frontier: Array<{node: TimeProfileNode, depth: number}> =
+      [{node: root, depth: 0}];
+  let built = 0;
+  while (built < count) {
+    const parent = frontier.shift();
+    if (parent === undefined) break;
+    const fanOut = parent.depth >= depth ?
+        0 :
+        1 + Math.floor(random() * Math.min(8, count - built));
+    for (let i = 0; i < fanOut && built < count; i++) {
+      const stringIndex = Math.floor(random() * cardinality);
+      const child: TimeProfileNode = {
+        name: names[stringIndex],
+        scriptName: scripts[Math.floor(random() * cardinality)],
+        scriptId: stringIndex,
+        lineNumber: 1 + Math.floor(random() * 5000),
+        columnNumber: 1 + Math.floor(random() * 120),
+        hitCount: Math.floor(random() * 10),
+        children: [],
+      };
+      parent.node.children.push(child);
+      frontier.push({node: child, depth: parent.depth + 1});
+      built++;
+    }
+  }
+  const endTime = Date.now() * 1000;
+  return {startTime: endTime - 60 * 1e6, endTime, topDownRoot: root};
+}
+
+function synthesizeHeapProfile(
+    count: number, depth: number, cardinality: number): AllocationProfileNode {
+  const random = makeRandom(29);
+  const names = buildStrings('allocator', cardinality);
+  const scripts = buildStrings('/srv/bundle/alloc', cardinality);
+  const root: AllocationProfileNode = {
+    name: '(root)',
+    scriptName: '',
+    scriptId: 0,
+    lineNumber: 0,
+    columnNumber: 0,
+    allocations: [],
+    children: [],
+  };
+  const frontier: Array<{node: AllocationProfileNode, depth: number}> =
+      [{node: root, depth: 0}];
+  let built = 0;
+  while (built < count) {
+    const parent = frontier.shift();
+    if (parent === undefined) break;
+    const fanOut = parent.depth >= depth ?
+        0 :
+        1 + Math.floor(random() * Math.min(8, count - built));
+    for (let i = 0; i < fanOut && built < count; i++) {
+      const stringIndex = Math.floor(random() * cardinality);
+      const child: AllocationProfileNode = {
+        name: names[stringIndex],
+        scriptName: scripts[Math.floor(random() * cardinality)],
+        scriptId: stringIndex,
+        lineNumber: 1 + Math.floor(random() * 5000),
+        columnNumber: 1 + Math.floor(random() * 120),
+        allocations: [{
+          sizeBytes: 32 << Math.floor(random() * 8),
+          count: 1 + Math.floor(random() * 100),
+        }],
+        children: [],
+      };
+      parent.node.children.push(child);
+      frontier.push({node: child, depth: parent.depth + 1});
+      built++;
+    }
+  }
+  return root;
+}
+
+function bench(stage: string, fn: () => unknown): StageResult {
+  for (let i = 0; i < WARMUP_ITERATIONS; i++) {
+    fn();
+  }
+  // tslint:disable-next-line no-any
+  const gc: (() => void)|undefined = (global as any).gc;
+  if (gc) gc();
+  const heapBefore = process.memoryUsage().heapUsed;
+  const start = process.hrtime();
+  for (let i = 0; i < iterations; i++) {
+    fn();
+  }
+  const elapsed = process.hrtime(start);
+  if (gc) gc();
+  const heapAfter = process.memoryUsage().heapUsed;
+  const totalMillis = elapsed[0] * 1e3 + elapsed[1] / 1e6;
+  return {
+    stage,
+    iterations,
+    opsPerSecond: iterations / (totalMillis / 1e3),
+    millisPerOp: totalMillis / iterations,
+    heapBytesPerOp: Math.max(0, heapAfter - heapBefore) / iterations,
+  };
+}
+
+/** Times a short real profiling run, whose stop() covers the native tree
+ * translation plus serialization; the synthetic stages above isolate the
+ * serialization part. */
+function benchNativeStop(): Promise<StageResult> {
+  return new Promise(resolve => {
+    const stop = time.start(BENCH_INTERVAL_MICROS);
+    const values: number[] = [];
+    const burnUntil = Date.now() + 500;
+    while (Date.now() < burnUntil) {
+      values.push(Math.sqrt(values.length + 1));
+    }
+    const start = process.hrtime();
+    stop();
+    const elapsed = process.hrtime(start);
+    const totalMillis = elapsed[0] * 1e3 + elapsed[1] / 1e6;
+    resolve({
+      stage: 'nativeStopAndSerialize',
+      iterations: 1,
+      opsPerSecond: 1 / (totalMillis / 1e3),
+      millisPerOp: totalMillis,
+      heapBytesPerOp: 0,
+    });
+  });
+}
+
+async function main(): Promise<void> {
+  const sourceMapper = useSourceMapper ? new SourceMapper() : undefined;
+  const timeProfile =
+      synthesizeTimeProfile(nodeCount, maxDepth, stringCardinality);
+  const heapProfile =
+      synthesizeHeapProfile(nodeCount, maxDepth, stringCardinality);
+  const serializedTime =
+      serializeTimeProfile(timeProfile, BENCH_INTERVAL_MICROS, sourceMapper);
+  const serializedHeap = serializeHeapProfile(
+      heapProfile, Date.now() * 1e6, BENCH_INTERVAL_BYTES, undefined,
+      sourceMapper);
+
+  const results: StageResult[] = [
+    bench(
+        'serializeTimeProfile',
+        () => serializeTimeProfile(
+            timeProfile, BENCH_INTERVAL_MICROS, sourceMapper)),
+    bench(
+        'serializeHeapProfile',
+        () => serializeHeapProfile(
+            heapProfile, Date.now() * 1e6, BENCH_INTERVAL_BYTES, undefined,
+            sourceMapper)),
+    bench('encodeTimeProfile', () => encodeSync(serializedTime)),
+    bench('encodeHeapProfile', () => encodeSync(serializedHeap)),
+    await benchNativeStop(),
+  ];
+
+  console.log(JSON.stringify(
+      {
+        parameters: {
+          nodeCount,
+          maxDepth,
+          stringCardinality,
+          iterations,
+          useSourceMapper,
+          gcExposed: typeof (global as {gc?: () => void}).gc === 'function',
+        },
+        results,
+      },
+      null, 2));
+}
+
+main().catch(err => {
+  console.error(err);
+  process.exit(1);
+});
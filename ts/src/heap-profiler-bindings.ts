@@ -40,6 +40,40 @@ export function stopSamplingHeapProfiler() {
   profiler.heapProfiler.stopSamplingHeapProfiler();
 }
 
+// Snapshots the accumulated allocation tree into native storage and halts
+// sampling; getAllocationProfile keeps returning the preserved tree.
+export function pauseSamplingHeapProfiler() {
+  profiler.heapProfiler.pauseSamplingHeapProfiler();
+}
+
+// Restarts sampling with the original parameters; the tree preserved by
+// pauseSamplingHeapProfiler is merged into subsequent collections.
+export function resumeSamplingHeapProfiler() {
+  profiler.heapProfiler.resumeSamplingHeapProfiler();
+}
+
 export function getAllocationProfile(): AllocationProfileNode {
   return profiler.heapProfiler.getAllocationProfile();
 }
+
+// Returns only the parts of the allocation profile which changed since the
+// previous call, with allocation counts expressed as deltas.
+export function getAllocationProfileDelta(): AllocationProfileNode {
+  return profiler.heapProfiler.getAllocationProfileDelta();
+}
+
+// Like getAllocationProfile, but performs string deduplication on a worker
+// thread and resolves once the profile has been materialized.
+export function getAllocationProfileAsync(): Promise<AllocationProfileNode> {
+  return new Promise<AllocationProfileNode>((resolve, reject) => {
+    profiler.heapProfiler.getAllocationProfileAsync(
+      (err: Error | null, profile?: AllocationProfileNode) => {
+        if (err) {
+          reject(err);
+        } else {
+          resolve(profile!);
+        }
+      }
+    );
+  });
+}
@@ -18,6 +18,10 @@ import { perftools } from '../../proto/profile';
 
 import {
   getAllocationProfile,
+  getAllocationProfileAsync,
+  getAllocationProfileDelta,
+  pauseSamplingHeapProfiler,
+  resumeSamplingHeapProfiler,
   startSamplingHeapProfiler,
   stopSamplingHeapProfiler,
 } from './heap-profiler-bindings';
@@ -26,6 +30,7 @@ import { SourceMapper } from './sourcemapper/sourcemapper';
 import { AllocationProfileNode } from './v8-types';
 
 let enabled = false;
+let paused = false;
 let heapIntervalBytes = 0;
 let heapStackDepth = 0;
 
@@ -78,6 +83,60 @@ export function profile(
   );
 }
 
+/*
+ * Like v8Profile, but builds the profile partially off the main thread and
+ * resolves once it is ready. Prefer this variant when collecting from a
+ * latency-sensitive process.
+ */
+export function v8ProfileAsync(): Promise<AllocationProfileNode> {
+  if (!enabled) {
+    return Promise.reject(new Error('Heap profiler is not enabled.'));
+  }
+  return getAllocationProfileAsync();
+}
+
+/*
+ * Collects the allocation delta since the previous v8ProfileDelta or
+ * profileDelta call when heapProfiler is enabled. Otherwise throws an error.
+ * Also throws while the profiler is paused, since sampling is halted and
+ * there is no live profile to diff against; delta collection resumes with
+ * resume().
+ *
+ * Data is returned in V8 allocation profile format; only nodes whose
+ * allocation counts grew since the previous collection are included.
+ */
+export function v8ProfileDelta(): AllocationProfileNode {
+  if (!enabled) {
+    throw new Error('Heap profiler is not enabled.');
+  }
+  if (paused) {
+    throw new Error('Heap profiler is paused.');
+  }
+  return getAllocationProfileDelta();
+}
+
+/**
+ * Collects an allocation delta (see v8ProfileDelta) and returns it serialized
+ * in pprof format. Throws if heap profiler is not enabled.
+ *
+ * @param ignoreSamplePath
+ * @param sourceMapper
+ */
+export function profileDelta(
+  ignoreSamplePath?: string,
+  sourceMapper?: SourceMapper
+): perftools.profiles.IProfile {
+  const startTimeNanos = Date.now() * 1000 * 1000;
+  const result = v8ProfileDelta();
+  return serializeHeapProfile(
+    result,
+    startTimeNanos,
+    heapIntervalBytes,
+    ignoreSamplePath,
+    sourceMapper
+  );
+}
+
 /**
  * Starts heap profiling. If heap profiling has already been started with
  * the same parameters, this is a noop. If heap profiler has already been
@@ -96,12 +155,43 @@ export function start(intervalBytes: number, stackDepth: number) {
   heapStackDepth = stackDepth;
   startSamplingHeapProfiler(heapIntervalBytes, heapStackDepth);
   enabled = true;
+  paused = false;
+}
+
+/**
+ * Pauses heap profiling: the accumulated allocation tree is preserved in
+ * native storage and sampling overhead drops to zero until resume() is
+ * called. profile(), v8Profile(), and v8ProfileAsync() keep returning the
+ * preserved tree while paused; delta collection throws until resume().
+ * Throws if heap profiler is not enabled; does nothing if already paused.
+ */
+export function pause() {
+  if (!enabled) {
+    throw new Error('Heap profiler is not enabled.');
+  }
+  pauseSamplingHeapProfiler();
+  paused = true;
+}
+
+/**
+ * Resumes heap profiling after pause(): sampling restarts with the original
+ * parameters and new samples are merged into the preserved tree, so
+ * long-lived allocation attribution survives duty-cycling. Throws if heap
+ * profiler is not enabled; does nothing if not paused.
+ */
+export function resume() {
+  if (!enabled) {
+    throw new Error('Heap profiler is not enabled.');
+  }
+  resumeSamplingHeapProfiler();
+  paused = false;
 }
 
 // Stops heap profiling. If heap profiling has not been started, does nothing.
 export function stop() {
   if (enabled) {
     enabled = false;
+    paused = false;
     stopSamplingHeapProfiler();
   }
 }
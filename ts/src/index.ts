@@ -20,23 +20,58 @@ import { encodeSync } from './profile-encoder';
 import * as timeProfiler from './time-profiler';
 export {
   AllocationProfileNode,
+  TimeProfile,
   TimeProfileNode,
+  TimestampedTimeProfile,
   ProfileNode,
 } from './v8-types';
 
-export { encode, encodeSync } from './profile-encoder';
+export {
+  encode,
+  EncodeOptions,
+  encodeSync,
+  encodeToStream,
+} from './profile-encoder';
+export {
+  ProfileSerializer,
+  serializeHeapProfile,
+  serializeTimeProfile,
+  serializeTimeProfiles,
+  serializeTimestampedTimeProfile,
+  serializeWeightedTimeProfiles,
+  StallMetrics,
+  ThreadTimeProfile,
+  WeightedTimeProfile,
+} from './profile-serializer';
 export { SourceMapper } from './sourcemapper/sourcemapper';
 
 export const time = {
   profile: timeProfiler.profile,
   start: timeProfiler.start,
+  startAdaptive: timeProfiler.startAdaptive,
+  startShared: timeProfiler.startShared,
+  startTimestamped: timeProfiler.startTimestamped,
+  setLabels: timeProfiler.setLabels,
+  clearLabels: timeProfiler.clearLabels,
+  startContinuous: timeProfiler.startContinuous,
+  collectDelta: timeProfiler.collectDelta,
+  stopContinuous: timeProfiler.stopContinuous,
+  startAggregated: timeProfiler.startAggregated,
+  aggregateCycle: timeProfiler.aggregateCycle,
+  flushAggregated: timeProfiler.flushAggregated,
+  stopAggregated: timeProfiler.stopAggregated,
 };
 
 export const heap = {
   start: heapProfiler.start,
   stop: heapProfiler.stop,
+  pause: heapProfiler.pause,
+  resume: heapProfiler.resume,
   profile: heapProfiler.profile,
+  profileDelta: heapProfiler.profileDelta,
   v8Profile: heapProfiler.v8Profile,
+  v8ProfileAsync: heapProfiler.v8ProfileAsync,
+  v8ProfileDelta: heapProfiler.v8ProfileDelta,
 };
 
 // If loaded with --require, start profiling.
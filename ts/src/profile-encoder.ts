@@ -15,20 +15,236 @@
  */
 
 import * as pify from 'pify';
-import { gzip, gzipSync } from 'zlib';
+import { createGzip, gzip, gzipSync } from 'zlib';
 
 import { perftools } from '../../proto/profile';
 
 const gzipPromise = pify(gzip);
 
+// Number of repeated-field elements encoded per chunk when streaming.
+const STREAM_BATCH_SIZE = 256;
+// Size of the slices written when streaming an already-serialized profile.
+const STREAM_CHUNK_BYTES = 64 * 1024;
+
+export interface EncodeOptions {
+  /**
+   * Output compression. 'gzip' (the default) is accepted by every profile
+   * backend; 'zstd' produces markedly smaller profiles for less compression
+   * CPU, but requires a Node runtime whose zlib exposes zstd support and a
+   * backend that accepts it. When zstd is requested on a runtime without
+   * it, encoding throws rather than silently changing the output format.
+   */
+  compression?: 'gzip' | 'zstd';
+  /** Compression level for the selected codec. Codec default when unset. */
+  level?: number;
+}
+
+// zstd entry points are feature-detected off the zlib module, so the
+// encoder loads (and gzip works) on runtimes that predate them.
+// tslint:disable-next-line no-any
+const zlibWithZstd = require('zlib') as any;
+
+function useZstd(options?: EncodeOptions): boolean {
+  if (!options || options.compression !== 'zstd') {
+    return false;
+  }
+  if (typeof zlibWithZstd.zstdCompressSync !== 'function') {
+    throw new Error(
+      'zstd compression is not supported by this Node runtime; use gzip'
+    );
+  }
+  return true;
+}
+
+// tslint:disable-next-line no-any
+function zstdOptions(level?: number): any {
+  return level === undefined
+    ? {}
+    : {
+        params: {
+          [zlibWithZstd.constants.ZSTD_c_compressionLevel]: level,
+        },
+      };
+}
+
+function gzipOptions(level?: number) {
+  return level === undefined ? {} : { level };
+}
+
+// Profiles may be either unserialized profile.proto objects or byte streams
+// already serialized by the native addon; the latter only need compression.
 export async function encode(
-  profile: perftools.profiles.IProfile
+  profile: perftools.profiles.IProfile | Buffer,
+  options?: EncodeOptions
 ): Promise<Buffer> {
-  const buffer = perftools.profiles.Profile.encode(profile).finish();
-  return gzipPromise(buffer);
+  const buffer = Buffer.isBuffer(profile)
+    ? profile
+    : perftools.profiles.Profile.encode(profile).finish();
+  if (useZstd(options)) {
+    return pify(zlibWithZstd.zstdCompress)(buffer, zstdOptions(options!.level));
+  }
+  return gzipPromise(buffer, gzipOptions(options && options.level));
+}
+
+export function encodeSync(
+  profile: perftools.profiles.IProfile | Buffer,
+  options?: EncodeOptions
+): Buffer {
+  const buffer = Buffer.isBuffer(profile)
+    ? profile
+    : perftools.profiles.Profile.encode(profile).finish();
+  if (useZstd(options)) {
+    return zlibWithZstd.zstdCompressSync(buffer, zstdOptions(options!.level));
+  }
+  return gzipSync(buffer, gzipOptions(options && options.level));
+}
+
+// Writes chunk to stream, waiting for 'drain' when the stream's buffer is
+// full so no more than the stream's high-water mark is held at once. A
+// stream that errors or closes while draining never emits 'drain', so
+// those events reject (and detach the listeners) rather than leaving the
+// caller suspended forever.
+function writeWithBackpressure(
+  stream: NodeJS.WritableStream,
+  chunk: Buffer
+): Promise<void> {
+  return new Promise<void>((resolve, reject) => {
+    if (stream.write(chunk)) {
+      resolve();
+      return;
+    }
+    const onDrain = () => {
+      cleanup();
+      resolve();
+    };
+    const onError = (err: Error) => {
+      cleanup();
+      reject(err);
+    };
+    const onClose = () => {
+      cleanup();
+      reject(new Error('stream closed while waiting for drain'));
+    };
+    function cleanup() {
+      stream.removeListener('drain', onDrain);
+      stream.removeListener('error', onError);
+      stream.removeListener('close', onClose);
+    }
+    stream.once('drain', onDrain);
+    stream.once('error', onError);
+    stream.once('close', onClose);
+  });
 }
 
-export function encodeSync(profile: perftools.profiles.IProfile): Buffer {
-  const buffer = perftools.profiles.Profile.encode(profile).finish();
-  return gzipSync(buffer);
+/**
+ * Encodes and compresses profile incrementally into sink (a file or socket
+ * stream) with backpressure. Each top-level repeated field is encoded in
+ * small batches and written through a compression stream (gzip by default;
+ * see EncodeOptions), so peak memory is a fixed chunk size rather than two
+ * full copies of the serialized profile as with encode(). A concatenation
+ * of independently-encoded top-level fields is a valid profile.proto
+ * message, so the output is identical to compressing the single-buffer
+ * encoding.
+ */
+export async function encodeToStream(
+  profile: perftools.profiles.IProfile | Buffer,
+  sink: NodeJS.WritableStream,
+  options?: EncodeOptions
+): Promise<void> {
+  const compressStream = useZstd(options)
+    ? zlibWithZstd.createZstdCompress(zstdOptions(options!.level))
+    : createGzip(gzipOptions(options && options.level));
+  const done = new Promise<void>((resolve, reject) => {
+    compressStream.on('error', reject);
+    sink.on('error', reject);
+    sink.on('finish', resolve);
+  });
+  // Errors on either stream also reject the write in flight (see below);
+  // mark done as handled so the duplicate rejection does not surface as
+  // unhandled while the write's rejection propagates.
+  done.catch(() => {});
+  compressStream.pipe(sink);
+  // pipe() only unpipes on a destination error; it neither errors nor closes
+  // the source, so a write parked on the compress stream's 'drain' would
+  // wait forever. Forward sink errors into the compress stream so the parked
+  // write (and any later write) rejects.
+  sink.on('error', err => compressStream.destroy(err));
+
+  if (Buffer.isBuffer(profile)) {
+    for (let offset = 0; offset < profile.length; offset += STREAM_CHUNK_BYTES) {
+      await writeWithBackpressure(
+        compressStream,
+        profile.slice(offset, offset + STREAM_CHUNK_BYTES)
+      );
+    }
+  } else {
+    // Scalar fields and value types are small; encode them in one chunk.
+    await writeWithBackpressure(
+      compressStream,
+      Buffer.from(
+        perftools.profiles.Profile.encode({
+          sampleType: profile.sampleType,
+          timeNanos: profile.timeNanos,
+          durationNanos: profile.durationNanos,
+          periodType: profile.periodType,
+          period: profile.period,
+        }).finish()
+      )
+    );
+    for (let i = 0; i < (profile.sample || []).length; i += STREAM_BATCH_SIZE) {
+      await writeWithBackpressure(
+        compressStream,
+        Buffer.from(
+          perftools.profiles.Profile.encode({
+            sample: profile.sample!.slice(i, i + STREAM_BATCH_SIZE),
+          }).finish()
+        )
+      );
+    }
+    for (
+      let i = 0;
+      i < (profile.location || []).length;
+      i += STREAM_BATCH_SIZE
+    ) {
+      await writeWithBackpressure(
+        compressStream,
+        Buffer.from(
+          perftools.profiles.Profile.encode({
+            location: profile.location!.slice(i, i + STREAM_BATCH_SIZE),
+          }).finish()
+        )
+      );
+    }
+    for (
+      let i = 0;
+      i < (profile.function || []).length;
+      i += STREAM_BATCH_SIZE
+    ) {
+      await writeWithBackpressure(
+        compressStream,
+        Buffer.from(
+          perftools.profiles.Profile.encode({
+            function: profile.function!.slice(i, i + STREAM_BATCH_SIZE),
+          }).finish()
+        )
+      );
+    }
+    for (
+      let i = 0;
+      i < (profile.stringTable || []).length;
+      i += STREAM_BATCH_SIZE
+    ) {
+      await writeWithBackpressure(
+        compressStream,
+        Buffer.from(
+          perftools.profiles.Profile.encode({
+            stringTable: profile.stringTable!.slice(i, i + STREAM_BATCH_SIZE),
+          }).finish()
+        )
+      );
+    }
+  }
+
+  compressStream.end();
+  await done;
 }
@@ -22,9 +22,11 @@ import {
 } from './sourcemapper/sourcemapper';
 import {
   AllocationProfileNode,
+  FlatTimeProfile,
   ProfileNode,
   TimeProfile,
   TimeProfileNode,
+  TimestampedTimeProfile,
 } from './v8-types';
 
 /**
@@ -100,22 +102,122 @@ class StringTable {
  * appends these to end of an array of samples.
  * @param stringTable - string table for the existing profile.
  */
-function serialize<T extends ProfileNode>(
-  profile: perftools.profiles.IProfile,
+/**
+ * Deduplication tables shared by one or more serialization passes. Several
+ * profiles may be serialized against the same tables (e.g. when merging
+ * per-thread profiles), so location and function ids stay unique across
+ * passes.
+ */
+interface SerializerTables {
+  stringTable: StringTable;
+  samples: perftools.profiles.Sample[];
+  locations: perftools.profiles.Location[];
+  functions: perftools.profiles.Function[];
+  // Dedup maps are keyed on numbers rather than stringified composites:
+  // function ids by scriptId then name's string-table index, location ids by
+  // function id then line/column packed into one number. Building and
+  // hashing composite key strings dominated serialization time on large
+  // trees.
+  locationIdMap: Map<number, Map<number, number>>;
+  functionIdMap: Map<number, Map<number, number>>;
+}
+
+function createSerializerTables(stringTable: StringTable): SerializerTables {
+  return {
+    stringTable,
+    samples: [],
+    locations: [],
+    functions: [],
+    locationIdMap: new Map<number, Map<number, number>>(),
+    functionIdMap: new Map<number, Map<number, number>>(),
+  };
+}
+
+function getFunction(
+  tables: SerializerTables,
+  scriptId?: number,
+  scriptName?: string,
+  name?: string
+): perftools.profiles.Function {
+  const { functions, functionIdMap, stringTable } = tables;
+  const nameId = stringTable.getIndexOrAdd(name || '(anonymous)');
+  let perScript = functionIdMap.get(scriptId || 0);
+  if (perScript === undefined) {
+    perScript = new Map<number, number>();
+    functionIdMap.set(scriptId || 0, perScript);
+  }
+  let id = perScript.get(nameId);
+  if (id !== undefined) {
+    // id is index+1, since 0 is not valid id.
+    return functions[id - 1];
+  }
+  id = functions.length + 1;
+  perScript.set(nameId, id);
+  const f = new perftools.profiles.Function({
+    id,
+    name: nameId,
+    systemName: nameId,
+    filename: stringTable.getIndexOrAdd(scriptName || ''),
+  });
+  functions.push(f);
+  return f;
+}
+
+function getLocation(
+  tables: SerializerTables,
+  node: ProfileNode,
+  sourceMapper?: SourceMapper
+): perftools.profiles.Location {
+  const { locations, locationIdMap } = tables;
+  let profLoc: SourceLocation = {
+    file: node.scriptName || '',
+    line: node.lineNumber,
+    column: node.columnNumber,
+    name: node.name,
+  };
+
+  if (profLoc.line) {
+    if (sourceMapper && isGeneratedLocation(profLoc)) {
+      profLoc = sourceMapper.mappingInfo(profLoc);
+    }
+  }
+  // The function id already covers script and (possibly source-mapped) name,
+  // so line and column are all that distinguishes locations within it.
+  const fn = getFunction(tables, node.scriptId, profLoc.file, profLoc.name);
+  const lineColumnKey =
+    (profLoc.line || 0) * 0x100000000 + (profLoc.column || 0);
+  let perFunction = locationIdMap.get(fn.id as number);
+  if (perFunction === undefined) {
+    perFunction = new Map<number, number>();
+    locationIdMap.set(fn.id as number, perFunction);
+  }
+  let id = perFunction.get(lineColumnKey);
+  if (id !== undefined) {
+    // id is index+1, since 0 is not valid id.
+    return locations[id - 1];
+  }
+  id = locations.length + 1;
+  perFunction.set(lineColumnKey, id);
+  const line = new perftools.profiles.Line({
+    functionId: fn.id,
+    line: profLoc.line,
+  });
+  const location = new perftools.profiles.Location({ id, line: [line] });
+  locations.push(location);
+  return location;
+}
+
+/**
+ * Walks the tree rooted at root, deduplicating locations and functions into
+ * tables and appending samples via appendToSamples.
+ */
+function serializeInto<T extends ProfileNode>(
+  tables: SerializerTables,
   root: T,
   appendToSamples: AppendEntryToSamples<T>,
-  stringTable: StringTable,
   ignoreSamplesPath?: string,
   sourceMapper?: SourceMapper
 ) {
-  const samples: perftools.profiles.Sample[] = [];
-  const locations: perftools.profiles.Location[] = [];
-  const functions: perftools.profiles.Function[] = [];
-  const locationMap: Map<number, perftools.profiles.Location> = new Map();
-  const functionMap: Map<number, perftools.profiles.Function> = new Map();
-  const functionIdMap = new Map<string, number>();
-  const locationIdMap = new Map<string, number>();
-
   const entries: Array<Entry<T>> = (root.children as T[]).map((n: T) => ({
     node: n,
     stack: [],
@@ -127,89 +229,13 @@ function serialize<T extends ProfileNode>(
       continue;
     }
     const stack = entry.stack;
-    const location = getLocation(node, sourceMapper);
+    const location = getLocation(tables, node, sourceMapper);
     stack.unshift(location.id as number);
-    appendToSamples(entry, samples);
+    appendToSamples(entry, tables.samples);
     for (const child of node.children as T[]) {
       entries.push({ node: child, stack: stack.slice() });
     }
   }
-
-  profile.sample = samples;
-  profile.location = locations;
-  profile.function = functions;
-  profile.stringTable = stringTable.strings;
-
-  function getLocation(
-    node: ProfileNode,
-    sourceMapper?: SourceMapper
-  ): perftools.profiles.Location {
-    let profLoc: SourceLocation = {
-      file: node.scriptName || '',
-      line: node.lineNumber,
-      column: node.columnNumber,
-      name: node.name,
-    };
-
-    if (profLoc.line) {
-      if (sourceMapper && isGeneratedLocation(profLoc)) {
-        profLoc = sourceMapper.mappingInfo(profLoc);
-      }
-    }
-    const keyStr = `${node.scriptId}:${profLoc.line}:${profLoc.column}:${profLoc.name}`;
-    let id = locationIdMap.get(keyStr);
-    if (id !== undefined) {
-      // id is index+1, since 0 is not valid id.
-      return locations[id - 1];
-    }
-    id = locations.length + 1;
-    locationIdMap.set(keyStr, id);
-    const line = getLine(
-      node.scriptId,
-      profLoc.file,
-      profLoc.name,
-      profLoc.line
-    );
-    const location = new perftools.profiles.Location({ id, line: [line] });
-    locations.push(location);
-    return location;
-  }
-
-  function getLine(
-    scriptId?: number,
-    scriptName?: string,
-    name?: string,
-    line?: number
-  ): perftools.profiles.Line {
-    return new perftools.profiles.Line({
-      functionId: getFunction(scriptId, scriptName, name).id,
-      line,
-    });
-  }
-
-  function getFunction(
-    scriptId?: number,
-    scriptName?: string,
-    name?: string
-  ): perftools.profiles.Function {
-    const keyStr = `${scriptId}:${name}`;
-    let id = functionIdMap.get(keyStr);
-    if (id !== undefined) {
-      // id is index+1, since 0 is not valid id.
-      return functions[id - 1];
-    }
-    id = functions.length + 1;
-    functionIdMap.set(keyStr, id);
-    const nameId = stringTable.getIndexOrAdd(name || '(anonymous)');
-    const f = new perftools.profiles.Function({
-      id,
-      name: nameId,
-      systemName: nameId,
-      filename: stringTable.getIndexOrAdd(scriptName || ''),
-    });
-    functions.push(f);
-    return f;
-  }
 }
 
 /**
@@ -262,18 +288,87 @@ function createAllocationValueType(
   });
 }
 
+/**
+ * GC pause and event-loop lag totals measured over a profiling window (see
+ * time.start's collectStallMetrics option). When passed to
+ * serializeTimeProfile they are emitted as two additional sample types in
+ * the same profile, attached to synthetic "(garbage collector)" and
+ * "(event loop lag)" frames, so one profile explains both CPU and stall
+ * behavior.
+ */
+export interface StallMetrics {
+  /** total GC pause time (microseconds) during the window. */
+  gcPauseMicros: number;
+  /** number of collections observed during the window. */
+  gcCount: number;
+  /** total event-loop lag (microseconds) during the window. */
+  eventLoopLagMicros: number;
+}
+
+/**
+ * @return value type for GC pause time (type:gcpause, units:microseconds),
+ * and adds strings used in this value type to the table.
+ */
+function createGCPauseValueType(
+  table: StringTable
+): perftools.profiles.ValueType {
+  return new perftools.profiles.ValueType({
+    type: table.getIndexOrAdd('gcpause'),
+    unit: table.getIndexOrAdd('microseconds'),
+  });
+}
+
+/**
+ * @return value type for event-loop lag (type:eventlooplag,
+ * units:microseconds), and adds strings used in this value type to the
+ * table.
+ */
+function createEventLoopLagValueType(
+  table: StringTable
+): perftools.profiles.ValueType {
+  return new perftools.profiles.ValueType({
+    type: table.getIndexOrAdd('eventlooplag'),
+    unit: table.getIndexOrAdd('microseconds'),
+  });
+}
+
 /**
  * Converts v8 time profile into into a profile proto.
  * (https://github.com/google/pprof/blob/master/proto/profile.proto)
  *
  * @param prof - profile to be converted.
  * @param intervalMicros - average time (microseconds) between samples.
+ * @param stallMetrics - optional GC pause and event-loop lag totals for the
+ * window, emitted as additional sample types.
  */
 export function serializeTimeProfile(
   prof: TimeProfile,
   intervalMicros: number,
-  sourceMapper?: SourceMapper
+  sourceMapper?: SourceMapper,
+  stallMetrics?: StallMetrics
 ): perftools.profiles.IProfile {
+  return serializeTimeProfileInto(
+    createSerializerTables(new StringTable()),
+    prof,
+    intervalMicros,
+    sourceMapper,
+    stallMetrics
+  );
+}
+
+/** serializeTimeProfile against caller-provided tables, so a persistent
+ * serializer can reuse them across cycles (see ProfileSerializer). */
+function serializeTimeProfileInto(
+  tables: SerializerTables,
+  prof: TimeProfile,
+  intervalMicros: number,
+  sourceMapper?: SourceMapper,
+  stallMetrics?: StallMetrics
+): perftools.profiles.IProfile {
+  // With stall metrics present every sample carries four values, so the
+  // tree's samples are padded with zeros for the stall types and the
+  // synthetic stall samples with zeros for the CPU types.
+  const stallPad: number[] = stallMetrics ? [0, 0] : [];
   const appendTimeEntryToSamples: AppendEntryToSamples<TimeProfileNode> = (
     entry: Entry<TimeProfileNode>,
     samples: perftools.profiles.Sample[]
@@ -281,34 +376,450 @@ export function serializeTimeProfile(
     if (entry.node.hitCount > 0) {
       const sample = new perftools.profiles.Sample({
         locationId: entry.stack,
-        value: [entry.node.hitCount, entry.node.hitCount * intervalMicros],
+        value: [
+          entry.node.hitCount,
+          entry.node.hitCount * intervalMicros,
+          ...stallPad,
+        ],
       });
       samples.push(sample);
     }
   };
 
+  const stringTable = tables.stringTable;
+  const sampleValueType = createSampleCountValueType(stringTable);
+  const timeValueType = createTimeValueType(stringTable);
+  const sampleType = [sampleValueType, timeValueType];
+
+  serializeInto(
+    tables,
+    prof.topDownRoot,
+    appendTimeEntryToSamples,
+    undefined,
+    sourceMapper
+  );
+
+  if (stallMetrics) {
+    sampleType.push(
+      createGCPauseValueType(stringTable),
+      createEventLoopLagValueType(stringTable)
+    );
+    // V8 already attributes GC CPU samples to a "(garbage collector)" node,
+    // so the pause total lands on the same frame and the two line up in
+    // flame views.
+    const gcLocation = getLocation(tables, {
+      name: '(garbage collector)',
+      scriptName: '',
+      children: [],
+    });
+    tables.samples.push(
+      new perftools.profiles.Sample({
+        locationId: [gcLocation.id as number],
+        value: [0, 0, stallMetrics.gcPauseMicros, 0],
+      })
+    );
+    const lagLocation = getLocation(tables, {
+      name: '(event loop lag)',
+      scriptName: '',
+      children: [],
+    });
+    tables.samples.push(
+      new perftools.profiles.Sample({
+        locationId: [lagLocation.id as number],
+        value: [0, 0, 0, stallMetrics.eventLoopLagMicros],
+      })
+    );
+  }
+
+  return {
+    sampleType,
+    sample: tables.samples,
+    location: tables.locations,
+    function: tables.functions,
+    stringTable: stringTable.strings,
+    timeNanos: Date.now() * 1000 * 1000,
+    durationNanos: (prof.endTime - prof.startTime) * 1000,
+    periodType: timeValueType,
+    period: intervalMicros,
+  };
+}
+
+/**
+ * A time profile collected on one thread (the main thread or a
+ * worker_threads worker), tagged with the name used for its per-sample
+ * "thread" label in the merged profile.
+ */
+export interface ThreadTimeProfile {
+  threadName: string;
+  profile: TimeProfile;
+}
+
+/**
+ * Merges time profiles collected over the same window on several threads
+ * into a single profile proto, with a per-sample "thread" label carrying the
+ * originating thread's name. Locations, functions, and strings are
+ * deduplicated across all input profiles.
+ *
+ * @param profs - per-thread profiles to be merged.
+ * @param intervalMicros - average time (microseconds) between samples.
+ */
+export function serializeTimeProfiles(
+  profs: ThreadTimeProfile[],
+  intervalMicros: number,
+  sourceMapper?: SourceMapper
+): perftools.profiles.IProfile {
   const stringTable = new StringTable();
   const sampleValueType = createSampleCountValueType(stringTable);
   const timeValueType = createTimeValueType(stringTable);
+  const tables = createSerializerTables(stringTable);
+  const threadKey = stringTable.getIndexOrAdd('thread');
+
+  let startTime = Infinity;
+  let endTime = -Infinity;
+  for (const { threadName, profile } of profs) {
+    const label = [
+      new perftools.profiles.Label({
+        key: threadKey,
+        str: stringTable.getIndexOrAdd(threadName),
+      }),
+    ];
+    const appendTimeEntryToSamples: AppendEntryToSamples<TimeProfileNode> = (
+      entry: Entry<TimeProfileNode>,
+      samples: perftools.profiles.Sample[]
+    ) => {
+      if (entry.node.hitCount > 0) {
+        samples.push(
+          new perftools.profiles.Sample({
+            locationId: entry.stack,
+            value: [entry.node.hitCount, entry.node.hitCount * intervalMicros],
+            label,
+          })
+        );
+      }
+    };
+    serializeInto(
+      tables,
+      profile.topDownRoot,
+      appendTimeEntryToSamples,
+      undefined,
+      sourceMapper
+    );
+    startTime = Math.min(startTime, profile.startTime);
+    endTime = Math.max(endTime, profile.endTime);
+  }
 
-  const profile = {
+  return {
     sampleType: [sampleValueType, timeValueType],
+    sample: tables.samples,
+    location: tables.locations,
+    function: tables.functions,
+    stringTable: stringTable.strings,
     timeNanos: Date.now() * 1000 * 1000,
-    durationNanos: (prof.endTime - prof.startTime) * 1000,
+    durationNanos: profs.length > 0 ? (endTime - startTime) * 1000 : 0,
     periodType: timeValueType,
     period: intervalMicros,
   };
+}
 
-  serialize(
-    profile,
-    prof.topDownRoot,
-    appendTimeEntryToSamples,
-    stringTable,
-    undefined,
-    sourceMapper
+/**
+ * Converts a timestamped time profile (see time.startTimestamped) into a
+ * profile proto with per-sample labels: each sample in the raw stream is
+ * attributed to the label set current when it was captured, and samples are
+ * re-aggregated by (stack, label set) so the output stays compact. Profiles
+ * collected without labels serialize identically to serializeTimeProfile.
+ *
+ * @param prof - timestamped profile to be converted.
+ * @param intervalMicros - average time (microseconds) between samples.
+ */
+export function serializeTimestampedTimeProfile(
+  prof: TimestampedTimeProfile,
+  intervalMicros: number,
+  sourceMapper?: SourceMapper
+): perftools.profiles.IProfile {
+  const stringTable = new StringTable();
+  const sampleValueType = createSampleCountValueType(stringTable);
+  const timeValueType = createTimeValueType(stringTable);
+  const tables = createSerializerTables(stringTable);
+
+  // Location stack (leaf first) for every node id in the profile tree.
+  const nodeStacks = new Map<number, number[]>();
+  const entries: Array<Entry<TimeProfileNode>> = (
+    prof.profile.topDownRoot.children as TimeProfileNode[]
+  ).map((n: TimeProfileNode) => ({ node: n, stack: [] }));
+  while (entries.length > 0) {
+    const entry = entries.pop()!;
+    const node = entry.node;
+    const stack = entry.stack;
+    const location = getLocation(tables, node, sourceMapper);
+    stack.unshift(location.id as number);
+    if (node.nodeId !== undefined) {
+      nodeStacks.set(node.nodeId, stack);
+    }
+    for (const child of node.children as TimeProfileNode[]) {
+      entries.push({ node: child, stack: stack.slice() });
+    }
+  }
+
+  // Re-aggregate the raw sample stream by (node, label set).
+  const counts = new Map<number, Map<number, number>>();
+  for (let i = 0; i < prof.sampleNodeIds.length; i++) {
+    const nodeId = prof.sampleNodeIds[i];
+    const labelIndex = prof.sampleLabelIndex ? prof.sampleLabelIndex[i] : -1;
+    let perNode = counts.get(nodeId);
+    if (perNode === undefined) {
+      perNode = new Map<number, number>();
+      counts.set(nodeId, perNode);
+    }
+    perNode.set(labelIndex, (perNode.get(labelIndex) || 0) + 1);
+  }
+
+  const labelSetLabels = (prof.labelSets || []).map(set =>
+    Object.keys(set).map(
+      key =>
+        new perftools.profiles.Label({
+          key: stringTable.getIndexOrAdd(key),
+          str: stringTable.getIndexOrAdd(set[key]),
+        })
+    )
   );
 
-  return profile;
+  for (const [nodeId, perNode] of counts) {
+    const stack = nodeStacks.get(nodeId);
+    if (stack === undefined) {
+      // Samples attributed to the "(root)" node have no stack.
+      continue;
+    }
+    for (const [labelIndex, count] of perNode) {
+      tables.samples.push(
+        new perftools.profiles.Sample({
+          locationId: stack,
+          value: [count, count * intervalMicros],
+          label: labelIndex >= 0 ? labelSetLabels[labelIndex] : [],
+        })
+      );
+    }
+  }
+
+  return {
+    sampleType: [sampleValueType, timeValueType],
+    sample: tables.samples,
+    location: tables.locations,
+    function: tables.functions,
+    stringTable: stringTable.strings,
+    timeNanos: Date.now() * 1000 * 1000,
+    durationNanos:
+      (prof.profile.endTime - prof.profile.startTime) * 1000,
+    periodType: timeValueType,
+    period: intervalMicros,
+  };
+}
+
+/**
+ * A time profile segment collected at a single sampling interval. Segments
+ * with different intervals arise when the adaptive governor adjusts the
+ * sampling rate during a collection window.
+ */
+export interface WeightedTimeProfile {
+  profile: TimeProfile;
+  /** average time (microseconds) between samples while this segment ran. */
+  intervalMicros: number;
+}
+
+/**
+ * Merges consecutive time profile segments collected at differing sampling
+ * intervals into a single profile proto, weighting each segment's samples by
+ * its own interval so wall-time values remain correct. Locations, functions,
+ * and strings are deduplicated across all segments.
+ *
+ * @param segments - profile segments to be merged, in collection order.
+ * @param periodIntervalMicros - interval (microseconds) reported as the
+ * profile's period; by convention the governor's floor interval.
+ */
+export function serializeWeightedTimeProfiles(
+  segments: WeightedTimeProfile[],
+  periodIntervalMicros: number,
+  sourceMapper?: SourceMapper
+): perftools.profiles.IProfile {
+  const stringTable = new StringTable();
+  const sampleValueType = createSampleCountValueType(stringTable);
+  const timeValueType = createTimeValueType(stringTable);
+  const tables = createSerializerTables(stringTable);
+
+  let startTime = Infinity;
+  let endTime = -Infinity;
+  for (const { profile, intervalMicros } of segments) {
+    const appendTimeEntryToSamples: AppendEntryToSamples<TimeProfileNode> = (
+      entry: Entry<TimeProfileNode>,
+      samples: perftools.profiles.Sample[]
+    ) => {
+      if (entry.node.hitCount > 0) {
+        samples.push(
+          new perftools.profiles.Sample({
+            locationId: entry.stack,
+            value: [entry.node.hitCount, entry.node.hitCount * intervalMicros],
+          })
+        );
+      }
+    };
+    serializeInto(
+      tables,
+      profile.topDownRoot,
+      appendTimeEntryToSamples,
+      undefined,
+      sourceMapper
+    );
+    startTime = Math.min(startTime, profile.startTime);
+    endTime = Math.max(endTime, profile.endTime);
+  }
+
+  return {
+    sampleType: [sampleValueType, timeValueType],
+    sample: tables.samples,
+    location: tables.locations,
+    function: tables.functions,
+    stringTable: stringTable.strings,
+    timeNanos: Date.now() * 1000 * 1000,
+    durationNanos: segments.length > 0 ? (endTime - startTime) * 1000 : 0,
+    periodType: timeValueType,
+    period: periodIntervalMicros,
+  };
+}
+
+/**
+ * Converts a time profile in the flat structure-of-arrays transfer format
+ * into a profile proto. Semantically equivalent to serializeTimeProfile, but
+ * consumes the typed arrays produced by stopProfilingFlat directly instead of
+ * walking a tree of per-node JS objects.
+ *
+ * @param prof - flat profile to be converted.
+ * @param intervalMicros - average time (microseconds) between samples.
+ */
+export function serializeTimeProfileFlat(
+  prof: FlatTimeProfile,
+  intervalMicros: number,
+  sourceMapper?: SourceMapper
+): perftools.profiles.IProfile {
+  const stringTable = new StringTable();
+  const sampleValueType = createSampleCountValueType(stringTable);
+  const timeValueType = createTimeValueType(stringTable);
+
+  const samples: perftools.profiles.Sample[] = [];
+  const locations: perftools.profiles.Location[] = [];
+  const functions: perftools.profiles.Function[] = [];
+  // Keyed numerically as in SerializerTables: function ids by scriptId then
+  // name's string-table index, location ids by function id then line/column
+  // packed into one number.
+  const functionIdMap = new Map<number, Map<number, number>>();
+  const locationIdMap = new Map<number, Map<number, number>>();
+
+  function getFunction(
+    scriptId: number,
+    scriptName?: string,
+    name?: string
+  ): perftools.profiles.Function {
+    const nameId = stringTable.getIndexOrAdd(name || '(anonymous)');
+    let perScript = functionIdMap.get(scriptId);
+    if (perScript === undefined) {
+      perScript = new Map<number, number>();
+      functionIdMap.set(scriptId, perScript);
+    }
+    let id = perScript.get(nameId);
+    if (id !== undefined) {
+      // id is index+1, since 0 is not valid id.
+      return functions[id - 1];
+    }
+    id = functions.length + 1;
+    perScript.set(nameId, id);
+    const f = new perftools.profiles.Function({
+      id,
+      name: nameId,
+      systemName: nameId,
+      filename: stringTable.getIndexOrAdd(scriptName || ''),
+    });
+    functions.push(f);
+    return f;
+  }
+
+  function getLocation(nodeIndex: number): perftools.profiles.Location {
+    let profLoc: SourceLocation = {
+      file: prof.stringTable[prof.scriptNameIndex[nodeIndex]] || '',
+      line: prof.lineNumber[nodeIndex],
+      column: prof.columnNumber[nodeIndex],
+      name: prof.stringTable[prof.nameIndex[nodeIndex]],
+    };
+    if (profLoc.line) {
+      if (sourceMapper && isGeneratedLocation(profLoc)) {
+        profLoc = sourceMapper.mappingInfo(profLoc);
+      }
+    }
+    // The function id already covers script and (possibly source-mapped)
+    // name, so line and column are all that distinguishes locations within
+    // it.
+    const fn = getFunction(
+      prof.scriptId[nodeIndex],
+      profLoc.file,
+      profLoc.name
+    );
+    const lineColumnKey =
+      (profLoc.line || 0) * 0x100000000 + (profLoc.column || 0);
+    let perFunction = locationIdMap.get(fn.id as number);
+    if (perFunction === undefined) {
+      perFunction = new Map<number, number>();
+      locationIdMap.set(fn.id as number, perFunction);
+    }
+    let id = perFunction.get(lineColumnKey);
+    if (id !== undefined) {
+      // id is index+1, since 0 is not valid id.
+      return locations[id - 1];
+    }
+    id = locations.length + 1;
+    perFunction.set(lineColumnKey, id);
+    const location = new perftools.profiles.Location({
+      id,
+      line: [
+        new perftools.profiles.Line({
+          functionId: fn.id,
+          line: profLoc.line,
+        }),
+      ],
+    });
+    locations.push(location);
+    return location;
+  }
+
+  // As in serialize(), the "(root)" node (index 0) is not emitted.
+  const nodeCount = prof.hitCount.length;
+  const nodeLocationIds = new Array<number>(nodeCount);
+  for (let i = 1; i < nodeCount; i++) {
+    nodeLocationIds[i] = getLocation(i).id as number;
+  }
+  for (let i = 1; i < nodeCount; i++) {
+    const hitCount = prof.hitCount[i];
+    if (hitCount > 0) {
+      const stack: number[] = [];
+      for (let j = i; j > 0; j = prof.parentIndex[j]) {
+        stack.push(nodeLocationIds[j]);
+      }
+      samples.push(
+        new perftools.profiles.Sample({
+          locationId: stack,
+          value: [hitCount, hitCount * intervalMicros],
+        })
+      );
+    }
+  }
+
+  return {
+    sampleType: [sampleValueType, timeValueType],
+    sample: samples,
+    location: locations,
+    function: functions,
+    stringTable: stringTable.strings,
+    timeNanos: Date.now() * 1000 * 1000,
+    durationNanos: (prof.endTime - prof.startTime) * 1000,
+    periodType: timeValueType,
+    period: intervalMicros,
+  };
 }
 
 /**
@@ -327,6 +838,26 @@ export function serializeHeapProfile(
   intervalBytes: number,
   ignoreSamplesPath?: string,
   sourceMapper?: SourceMapper
+): perftools.profiles.IProfile {
+  return serializeHeapProfileInto(
+    createSerializerTables(new StringTable()),
+    prof,
+    startTimeNanos,
+    intervalBytes,
+    ignoreSamplesPath,
+    sourceMapper
+  );
+}
+
+/** serializeHeapProfile against caller-provided tables, so a persistent
+ * serializer can reuse them across cycles (see ProfileSerializer). */
+function serializeHeapProfileInto(
+  tables: SerializerTables,
+  prof: AllocationProfileNode,
+  startTimeNanos: number,
+  intervalBytes: number,
+  ignoreSamplesPath?: string,
+  sourceMapper?: SourceMapper
 ): perftools.profiles.IProfile {
   const appendHeapEntryToSamples: AppendEntryToSamples<AllocationProfileNode> = (
     entry: Entry<AllocationProfileNode>,
@@ -344,24 +875,73 @@ export function serializeHeapProfile(
     }
   };
 
-  const stringTable = new StringTable();
+  const stringTable = tables.stringTable;
   const sampleValueType = createObjectCountValueType(stringTable);
   const allocationValueType = createAllocationValueType(stringTable);
 
-  const profile = {
+  serializeInto(tables, prof, appendHeapEntryToSamples, ignoreSamplesPath, sourceMapper);
+
+  return {
     sampleType: [sampleValueType, allocationValueType],
+    sample: tables.samples,
+    location: tables.locations,
+    function: tables.functions,
+    stringTable: stringTable.strings,
     timeNanos: startTimeNanos,
     periodType: allocationValueType,
     period: intervalBytes,
   };
+}
 
-  serialize(
-    profile,
-    prof,
-    appendHeapEntryToSamples,
-    stringTable,
-    ignoreSamplesPath,
-    sourceMapper
-  );
-  return profile;
+/**
+ * Serializer that retains its string table and location/function dedup
+ * tables across profile cycles. A long-running collector serializes the
+ * same few thousand frame strings every cycle; with retained tables,
+ * steady-state cycles only intern genuinely new frames, and repeated
+ * source-map and id lookups become table hits. Emitted profiles share the
+ * accumulated location, function, and string tables (pprof permits entries
+ * a given profile does not reference); samples are per-cycle. Pairs
+ * naturally with the native aggregation API but is independent of it.
+ *
+ * Use one instance per profile stream; time and heap profiles may share an
+ * instance, since sample types are emitted per profile.
+ */
+export class ProfileSerializer {
+  private tables = createSerializerTables(new StringTable());
+
+  /** See serializeTimeProfile. */
+  serializeTimeProfile(
+    prof: TimeProfile,
+    intervalMicros: number,
+    sourceMapper?: SourceMapper,
+    stallMetrics?: StallMetrics
+  ): perftools.profiles.IProfile {
+    this.tables.samples = [];
+    return serializeTimeProfileInto(
+      this.tables,
+      prof,
+      intervalMicros,
+      sourceMapper,
+      stallMetrics
+    );
+  }
+
+  /** See serializeHeapProfile. */
+  serializeHeapProfile(
+    prof: AllocationProfileNode,
+    startTimeNanos: number,
+    intervalBytes: number,
+    ignoreSamplesPath?: string,
+    sourceMapper?: SourceMapper
+  ): perftools.profiles.IProfile {
+    this.tables.samples = [];
+    return serializeHeapProfileInto(
+      this.tables,
+      prof,
+      startTimeNanos,
+      intervalBytes,
+      ignoreSamplesPath,
+      sourceMapper
+    );
+  }
 }
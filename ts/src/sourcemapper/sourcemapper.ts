@@ -28,13 +28,97 @@ import * as scanner from '../../third_party/cloud-debug-nodejs/src/agent/io/scan
 const pify = require('pify');
 const pLimit = require('p-limit');
 const readFile = pify(fs.readFile);
+const writeFile = pify(fs.writeFile);
+const stat = pify(fs.stat);
 
 const CONCURRENCY = 10;
 const MAP_EXT = '.map';
+// Default bound on the number of parsed source map consumers kept in memory
+// at once in lazy mode; profiles only touch a small working set of files.
+const DEFAULT_CONSUMER_CACHE_SIZE = 64;
+const INDEX_FILE_VERSION = 1;
+
+/**
+ * On-disk cache of the .map file paths discovered under a set of search
+ * directories, so that a warm start can skip the full directory scan.
+ */
+interface SourceMapIndex {
+  version: number;
+  searchDirs: string[];
+  mapFiles: Array<{ path: string; mtime: number }>;
+}
+
+/**
+ * Loads a previously written index file and returns its map file paths, or
+ * null if the index is missing, malformed, was built for different search
+ * directories, or any indexed map file has since been modified or removed
+ * (validated by mtime). Files added after the index was written are not
+ * detected; delete the index file to force a rescan.
+ */
+async function tryLoadMapFileIndex(
+  indexFilePath: string,
+  searchDirs: string[]
+): Promise<string[] | null> {
+  let index: SourceMapIndex;
+  try {
+    index = JSON.parse(await readFile(indexFilePath, 'utf8'));
+  } catch (e) {
+    return null;
+  }
+  if (
+    index.version !== INDEX_FILE_VERSION ||
+    !Array.isArray(index.mapFiles) ||
+    JSON.stringify(index.searchDirs) !==
+      JSON.stringify(searchDirs.map(d => path.resolve(d)))
+  ) {
+    return null;
+  }
+  try {
+    await Promise.all(
+      index.mapFiles.map(async entry => {
+        const stats = await stat(entry.path);
+        if (stats.mtimeMs !== entry.mtime) {
+          throw new Error(`source map file ${entry.path} has changed`);
+        }
+      })
+    );
+  } catch (e) {
+    return null;
+  }
+  return index.mapFiles.map(entry => entry.path);
+}
+
+/** Writes the index file for the given map files. Failures are ignored;
+ * the index is purely an optimization. */
+async function writeMapFileIndex(
+  indexFilePath: string,
+  searchDirs: string[],
+  mapFiles: string[]
+): Promise<void> {
+  try {
+    const index: SourceMapIndex = {
+      version: INDEX_FILE_VERSION,
+      searchDirs: searchDirs.map(d => path.resolve(d)),
+      mapFiles: await Promise.all(
+        mapFiles.map(async mapPath => {
+          const stats = await stat(mapPath);
+          return { path: mapPath, mtime: stats.mtimeMs };
+        })
+      ),
+    };
+    await writeFile(indexFilePath, JSON.stringify(index), 'utf8');
+  } catch (e) {
+    // Ignored: the next cold start will scan and try again.
+  }
+}
 
 export interface MapInfoCompiled {
   mapFileDir: string;
-  mapConsumer: sourceMap.RawSourceMap;
+  /** Parsed consumer, or null when the map has been recorded but not yet
+   * parsed (lazy mode) or has been evicted from the consumer cache. */
+  mapConsumer: sourceMap.RawSourceMap | null;
+  /** Path to the .map file backing this entry. */
+  mapPath: string;
 }
 
 export interface GeneratedLocation {
@@ -109,13 +193,92 @@ async function processSourceMap(
     : path.basename(mapPath, MAP_EXT);
   const generatedPath = path.resolve(dir, generatedBase);
 
-  infoMap.set(generatedPath, { mapFileDir: dir, mapConsumer: consumer });
+  infoMap.set(generatedPath, {
+    mapFileDir: dir,
+    mapConsumer: consumer,
+    mapPath,
+  });
+}
+
+/**
+ * Records a source map file in infoMap without constructing a consumer for
+ * it. The generated file path must be derived exactly as processSourceMap
+ * derives it when the map is parsed later — from the map's "file"
+ * attribute when present — or the parsed entry lands under a different key
+ * and its consumer is orphaned: never found by mappingInfo and never
+ * evicted by the LRU. Bundlers routinely emit hashed output names whose
+ * "file" attribute differs from the map file's own name, so the attribute
+ * is read here; only the one field is kept and no SourceMapConsumer is
+ * built, which is where lazy mode's memory savings lie.
+ *
+ * @private
+ */
+async function recordSourceMapPath(
+  infoMap: Map<string, MapInfoCompiled>,
+  mapPath: string
+): Promise<void> {
+  if (!mapPath || !mapPath.endsWith(MAP_EXT)) {
+    throw new Error(`The path "${mapPath}" does not specify a source map file`);
+  }
+  mapPath = path.normalize(mapPath);
+  let file: string | undefined;
+  try {
+    file = (JSON.parse(await readFile(mapPath, 'utf8')) as { file?: string })
+      .file;
+  } catch (e) {
+    throw new Error('Could not read source map file ' + mapPath + ': ' + e);
+  }
+  const dir = path.dirname(mapPath);
+  const generatedBase = file ? file : path.basename(mapPath, MAP_EXT);
+  const generatedPath = path.resolve(dir, generatedBase);
+  infoMap.set(generatedPath, { mapFileDir: dir, mapConsumer: null, mapPath });
 }
 
 export class SourceMapper {
   infoMap: Map<string, MapInfoCompiled>;
+  /** Generated paths with a parsed consumer, in least-recently-used-first
+   * order. Only populated in lazy mode; eager mode keeps every consumer. */
+  private loadedPaths: string[];
+  private consumerCacheSize: number;
+  private lazy: boolean;
+  /** Memoized resolution results, keyed by normalized generated path and
+   * then by line/column packed into one number. Code does not change at
+   * runtime, so entries stay valid across profile cycles and consumer
+   * evictions; the same hot generated locations recur every cycle, and
+   * consumer lookups dominated serialization time without this. Size is
+   * bounded by the number of distinct sampled code locations. */
+  private mappingCache: Map<string, Map<number, SourceLocation>>;
+  /** Whether the missing-ensureLoaded warning has been emitted; mappingInfo
+   * is called per frame, so the warning is logged once per mapper. */
+  private warnedUnloaded = false;
 
-  static async create(searchDirs: string[]): Promise<SourceMapper> {
+  /**
+   * @param searchDirs - directories to be scanned for .map files.
+   * @param indexFilePath - optional path to a persistent index file. When
+   *  given, a valid index written by a previous run allows the directory
+   *  scan to be skipped entirely; after a scan the index is (re)written.
+   * @param lazyParse - when true, map files are only indexed at create time
+   *  and parsed on first use, with parsed consumers kept in a size-bounded
+   *  LRU cache, so memory tracks the working set of hot files instead of
+   *  every map in the deployment. Callers must await ensureLoaded with the
+   *  generated file paths they are about to map before calling mappingInfo;
+   *  locations in files whose map has not been loaded are returned unmapped
+   *  (with a one-time warning).
+   */
+  static async create(
+    searchDirs: string[],
+    indexFilePath?: string,
+    lazyParse?: boolean
+  ): Promise<SourceMapper> {
+    if (indexFilePath) {
+      const indexedMapFiles = await tryLoadMapFileIndex(
+        indexFilePath,
+        searchDirs
+      );
+      if (indexedMapFiles !== null) {
+        return createFromMapFiles(indexedMapFiles, lazyParse);
+      }
+    }
     const mapFiles: string[] = [];
     for (const dir of searchDirs) {
       try {
@@ -127,7 +290,10 @@ export class SourceMapper {
         throw new Error(`failed to get source maps from ${dir}: ${e}`);
       }
     }
-    return createFromMapFiles(mapFiles);
+    if (indexFilePath) {
+      await writeMapFileIndex(indexFilePath, searchDirs, mapFiles);
+    }
+    return createFromMapFiles(mapFiles, lazyParse);
   }
 
   /**
@@ -138,8 +304,77 @@ export class SourceMapper {
    *  processing the given source map files
    * @constructor
    */
-  constructor() {
+  constructor(lazy = false, consumerCacheSize = DEFAULT_CONSUMER_CACHE_SIZE) {
     this.infoMap = new Map();
+    this.loadedPaths = [];
+    this.consumerCacheSize = consumerCacheSize;
+    this.lazy = lazy;
+    this.mappingCache = new Map();
+  }
+
+  /**
+   * Parses the source maps needed to map locations in the given generated
+   * files, evicting (and destroying) the least recently used consumers when
+   * the cache bound is exceeded. In lazy mode this must be called before
+   * mappingInfo can map locations in those files; paths without mapping
+   * information are ignored. A no-op in eager mode.
+   */
+  async ensureLoaded(inputPaths: string[]): Promise<void> {
+    if (!this.lazy) {
+      return;
+    }
+    for (const inputPath of inputPaths) {
+      const normalizedPath = path.normalize(inputPath);
+      const entry = this.infoMap.get(normalizedPath);
+      if (entry === undefined) {
+        continue;
+      }
+      if (entry.mapConsumer !== null) {
+        this.touch(normalizedPath);
+        continue;
+      }
+      try {
+        await processSourceMap(this.infoMap, entry.mapPath);
+      } catch (e) {
+        // A map that cannot be parsed is treated as absent.
+        this.infoMap.delete(normalizedPath);
+        continue;
+      }
+      const loaded = this.infoMap.get(normalizedPath);
+      if (loaded !== undefined && loaded.mapConsumer !== null) {
+        this.touch(normalizedPath);
+      }
+    }
+    while (this.loadedPaths.length > this.consumerCacheSize) {
+      this.evict(this.loadedPaths[0]);
+    }
+  }
+
+  /** Moves inputPath to the most-recently-used end of the LRU order. */
+  private touch(inputPath: string): void {
+    const idx = this.loadedPaths.indexOf(inputPath);
+    if (idx !== -1) {
+      this.loadedPaths.splice(idx, 1);
+    }
+    this.loadedPaths.push(inputPath);
+  }
+
+  /** Drops the parsed consumer for inputPath, keeping the entry so the map
+   * can be re-parsed on a later ensureLoaded call. */
+  private evict(inputPath: string): void {
+    this.loadedPaths = this.loadedPaths.filter(p => p !== inputPath);
+    const entry = this.infoMap.get(inputPath);
+    if (entry === undefined || entry.mapConsumer === null) {
+      return;
+    }
+    // source-map 0.7 consumers hold wasm-backed memory which must be
+    // explicitly released.
+    // tslint:disable-next-line: no-any
+    const consumer = entry.mapConsumer as any;
+    if (typeof consumer.destroy === 'function') {
+      consumer.destroy();
+    }
+    entry.mapConsumer = null;
   }
 
   /**
@@ -198,34 +433,91 @@ export class SourceMapper {
    */
   mappingInfo(location: GeneratedLocation): SourceLocation {
     const inputPath = path.normalize(location.file);
+    const lineColumnKey = location.line * 0x100000000 + (location.column || 0);
+    const cachedForPath = this.mappingCache.get(inputPath);
+    if (cachedForPath !== undefined) {
+      const cached = cachedForPath.get(lineColumnKey);
+      if (cached !== undefined) {
+        // name falls back to the caller's name when the map had none, so it
+        // is re-applied per call rather than baked into the cache entry.
+        return {
+          file: cached.file,
+          line: cached.line,
+          name: cached.name || location.name,
+          column: cached.column,
+        };
+      }
+    }
+
     const entry = this.getMappingInfo(inputPath);
     if (entry === null) {
       return location;
     }
 
+    if (entry.mapConsumer === null) {
+      // Lazy mode with the map not (or no longer) parsed; the caller must use
+      // ensureLoaded before mapping locations in this file. Returning the
+      // unmapped location silently would make a missing ensureLoaded call
+      // look like a bad source map, so warn the first time this happens.
+      // Not cached, since the map may be parsed later.
+      if (!this.warnedUnloaded) {
+        this.warnedUnloaded = true;
+        console.warn(
+          `pprof: source map for ${inputPath} is indexed but not loaded; ` +
+            'call ensureLoaded before mappingInfo when lazy parsing is ' +
+            'enabled. Returning unmapped locations.'
+        );
+      }
+      return location;
+    }
+
     const generatedPos = { line: location.line, column: location.column };
 
     // TODO: Determine how to remove the explicit cast here.
     const consumer: sourceMap.SourceMapConsumer = (entry.mapConsumer as {}) as sourceMap.SourceMapConsumer;
 
     const pos = consumer.originalPositionFor(generatedPos);
-    if (pos.source === null) {
-      return location;
+    const resolved: SourceLocation =
+      pos.source === null
+        ? {
+            file: location.file,
+            line: location.line,
+            name: undefined,
+            column: location.column,
+          }
+        : {
+            file: path.resolve(entry.mapFileDir, pos.source),
+            line: pos.line || undefined,
+            name: pos.name || undefined,
+            column: pos.column || undefined,
+          };
+    let perPath = cachedForPath;
+    if (perPath === undefined) {
+      perPath = new Map<number, SourceLocation>();
+      this.mappingCache.set(inputPath, perPath);
     }
+    perPath.set(lineColumnKey, resolved);
     return {
-      file: path.resolve(entry.mapFileDir, pos.source),
-      line: pos.line || undefined,
-      name: pos.name || location.name,
-      column: pos.column || undefined,
+      file: resolved.file,
+      line: resolved.line,
+      name: resolved.name || location.name,
+      column: resolved.column,
     };
   }
 }
 
-async function createFromMapFiles(mapFiles: string[]): Promise<SourceMapper> {
+async function createFromMapFiles(
+  mapFiles: string[],
+  lazyParse?: boolean
+): Promise<SourceMapper> {
+  const mapper = new SourceMapper(lazyParse);
   const limit = pLimit(CONCURRENCY);
-  const mapper = new SourceMapper();
   const promises: Array<Promise<void>> = mapFiles.map(mapPath =>
-    limit(() => processSourceMap(mapper.infoMap, mapPath))
+    limit(() =>
+      lazyParse
+        ? recordSourceMapPath(mapper.infoMap, mapPath)
+        : processSourceMap(mapper.infoMap, mapPath)
+    )
   );
   try {
     await Promise.all(promises);
@@ -14,7 +14,11 @@
  * limitations under the License.
  */
 import * as path from 'path';
-import { TimeProfile } from './v8-types';
+import {
+  FlatTimeProfile,
+  TimeProfile,
+  TimestampedTimeProfile,
+} from './v8-types';
 
 const binary = require('node-pre-gyp');
 const bindingPath = binary.find(
@@ -23,17 +27,211 @@ const bindingPath = binary.find(
 const profiler = require(bindingPath);
 
 // Wrappers around native time profiler functions.
-export function startProfiling(runName: string, includeLineInfo?: boolean) {
+// recordSamples keeps the raw sample stream for stopProfilingTimestamped;
+// a positive maxSamples caps that stream (not the aggregated tree) and is
+// only honored together with recordSamples. On V8 versions without a
+// per-session sample limit the cap is ignored.
+export function startProfiling(
+  runName: string,
+  includeLineInfo?: boolean,
+  maxSamples?: number,
+  recordSamples?: boolean
+) {
+  if (recordSamples !== undefined) {
+    profiler.timeProfiler.startProfiling(
+      runName,
+      includeLineInfo || false,
+      maxSamples || 0,
+      recordSamples
+    );
+    return;
+  }
+  if (maxSamples !== undefined) {
+    profiler.timeProfiler.startProfiling(
+      runName,
+      includeLineInfo || false,
+      maxSamples
+    );
+    return;
+  }
   profiler.timeProfiler.startProfiling(runName, includeLineInfo || false);
 }
 
+// When ignoreSamplesPath is non-empty or minHitCount is positive, matching
+// and below-threshold subtrees are pruned within the addon, before any JS
+// objects are created for them. A positive maxDepth truncates translated
+// stacks at that depth, folding deeper frames' hits into the node at the
+// cap. Neither can be combined with includeLineInfo.
 export function stopProfiling(
   runName: string,
-  includeLineInfo?: boolean
+  includeLineInfo?: boolean,
+  ignoreSamplesPath?: string,
+  minHitCount?: number,
+  maxDepth?: number
 ): TimeProfile {
+  if (maxDepth !== undefined) {
+    return profiler.timeProfiler.stopProfiling(
+      runName,
+      includeLineInfo || false,
+      ignoreSamplesPath || '',
+      minHitCount || 0,
+      maxDepth
+    );
+  }
+  if (ignoreSamplesPath !== undefined || minHitCount !== undefined) {
+    return profiler.timeProfiler.stopProfiling(
+      runName,
+      includeLineInfo || false,
+      ignoreSamplesPath || '',
+      minHitCount || 0
+    );
+  }
   return profiler.timeProfiler.stopProfiling(runName, includeLineInfo || false);
 }
 
+// Stops profiling and returns the profile as parallel typed arrays plus a
+// string table (see FlatTimeProfile), performing one large allocation per
+// field rather than one JS object per node.
+export function stopProfilingFlat(runName: string): FlatTimeProfile {
+  return profiler.timeProfiler.stopProfilingFlat(runName);
+}
+
+// Stops the profile and writes it, in the flat structure-of-arrays layout,
+// into a memory-mapped file at path for consumption by a sidecar process
+// (see time.startShared). Returns the number of bytes written. Not
+// supported on Windows.
+export function stopProfilingShared(runName: string, path: string): number {
+  return profiler.timeProfiler.stopProfilingShared(runName, path);
+}
+
+// Stops a profile started with recordSamples, returning the profile tree
+// (with nodeId on every node) plus the raw sample stream (node id and
+// timestamp per sample) as parallel typed arrays.
+export function stopProfilingTimestamped(
+  runName: string
+): TimestampedTimeProfile {
+  return profiler.timeProfiler.stopProfilingTimestamped(runName);
+}
+
+// Stops profiling without blocking the event loop: the profile tree is
+// extracted on a libuv worker thread, and only the translation of the
+// extracted data back to JS objects runs on the main thread. Does not
+// support line-level profiles.
+export function stopProfilingAsync(runName: string): Promise<TimeProfile> {
+  return new Promise<TimeProfile>((resolve, reject) => {
+    profiler.timeProfiler.stopProfilingAsync(
+      runName,
+      (err: Error | null, profile?: TimeProfile) => {
+        if (err) {
+          reject(err);
+        } else {
+          resolve(profile!);
+        }
+      }
+    );
+  });
+}
+
+// Stops profiling and returns a gzipped profile.proto byte stream, ready for
+// upload. Both serialization and compression run on a libuv worker thread,
+// replacing the protobufjs-encode-then-gzip double pass of profile-encoder.
+export function stopProfilingEncoded(
+  runName: string,
+  intervalMicros: number
+): Promise<Buffer> {
+  return new Promise<Buffer>((resolve, reject) => {
+    profiler.timeProfiler.stopProfilingEncoded(
+      runName,
+      intervalMicros,
+      (err: Error | null, buffer?: Buffer) => {
+        if (err) {
+          reject(err);
+        } else {
+          resolve(buffer!);
+        }
+      }
+    );
+  });
+}
+
+// Stops profiling and returns the profile as an uncompressed
+// perftools.profiles.Profile byte stream serialized within the addon,
+// skipping the per-node JS object translation.
+export function stopProfilingProto(
+  runName: string,
+  intervalMicros: number
+): Buffer {
+  return profiler.timeProfiler.stopProfilingProto(runName, intervalMicros);
+}
+
+// Wrappers around the native multi-cycle aggregator, which folds successive
+// profiler runs into one merged profile (summed sample values, shared string
+// table) held within the addon.
+export function startAggregation(intervalMicros: number) {
+  profiler.timeProfiler.startAggregation(intervalMicros);
+}
+
+// Stops the named profiler run and folds it into the merged profile without
+// materializing it as JS objects.
+export function aggregateProfile(runName: string) {
+  profiler.timeProfiler.aggregateProfile(runName);
+}
+
+// Emits the merged profile as an uncompressed perftools.profiles.Profile
+// byte stream and resets the aggregator for the next window.
+export function flushAggregatedProfile(): Buffer {
+  return profiler.timeProfiler.flushAggregatedProfile();
+}
+
+export function stopAggregation() {
+  profiler.timeProfiler.stopAggregation();
+}
+
+// Registers a label set (e.g. a route name) as current; samples collected
+// in timestamped mode while it is current are attributed to it by timestamp
+// within the addon, with no per-sample JS bookkeeping.
+export function setLabels(labels: { [key: string]: string }) {
+  profiler.timeProfiler.setLabels(labels);
+}
+
+// Marks the current label set as no longer applying.
+export function clearLabels() {
+  profiler.timeProfiler.clearLabels();
+}
+
+// Total GC pause time and collection count observed between
+// startGcTracking and stopGcTracking.
+export interface GcTrackingMetrics {
+  gcPauseMicros: number;
+  gcCount: number;
+}
+
+// Starts accumulating GC pause time within the addon, via GC
+// prologue/epilogue callbacks bracketing each collection.
+export function startGcTracking() {
+  profiler.timeProfiler.startGcTracking();
+}
+
+// Stops accumulating and returns the totals since startGcTracking.
+export function stopGcTracking(): GcTrackingMetrics {
+  return profiler.timeProfiler.stopGcTracking();
+}
+
 export function setSamplingInterval(intervalMicros: number) {
   profiler.timeProfiler.setSamplingInterval(intervalMicros);
 }
+
+// Wrappers around the continuous-profiling mode, which keeps one long-running
+// CpuProfiler session alive and hands back only the samples accumulated since
+// the previous collection.
+export function startContinuousProfiling() {
+  profiler.timeProfiler.startContinuousProfiling();
+}
+
+export function collectContinuousDelta(): TimeProfile {
+  return profiler.timeProfiler.collectContinuousDelta();
+}
+
+export function stopContinuousProfiling() {
+  profiler.timeProfiler.stopContinuousProfiling();
+}
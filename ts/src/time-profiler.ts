@@ -16,18 +16,42 @@
 
 import delay from 'delay';
 
-import { serializeTimeProfile } from './profile-serializer';
+import {
+  serializeTimeProfile,
+  serializeTimeProfileFlat,
+  serializeWeightedTimeProfiles,
+  StallMetrics,
+  WeightedTimeProfile,
+} from './profile-serializer';
 import { SourceMapper } from './sourcemapper/sourcemapper';
+import { perftools } from '../../proto/profile';
 import {
+  aggregateProfile,
+  collectContinuousDelta,
+  flushAggregatedProfile,
   setSamplingInterval,
+  startAggregation,
+  startContinuousProfiling,
+  startGcTracking,
   startProfiling,
+  stopAggregation,
+  stopContinuousProfiling,
+  stopGcTracking,
   stopProfiling,
+  stopProfilingFlat,
+  stopProfilingProto,
+  stopProfilingShared,
+  stopProfilingTimestamped,
 } from './time-profiler-bindings';
+import { TimestampedTimeProfile } from './v8-types';
 
 let profiling = false;
 
 const DEFAULT_INTERVAL_MICROS: Microseconds = 1000;
 
+// How often the stall-metrics lag sampler ticks (see collectStallMetrics).
+const STALL_CHECK_PERIOD_MILLIS = 100;
+
 type Microseconds = number;
 type Milliseconds = number;
 
@@ -46,25 +70,157 @@ export interface TimeProfilerOptions {
    * This defaults to false.
    */
   lineNumbers?: boolean;
+
+  /**
+   * When set to true, the profile is serialized to a profile.proto byte
+   * stream within the native addon and returned as a Buffer, rather than
+   * being translated node-by-node into JS objects and serialized by
+   * profile-serializer. This avoids blocking the event loop on large
+   * profiles, but cannot be combined with sourceMapper or lineNumbers.
+   * This defaults to false.
+   */
+  nativeSerialization?: boolean;
+
+  /**
+   * When set to true, the profile crosses the native boundary as a handful
+   * of preallocated typed arrays (see FlatTimeProfile) instead of one JS
+   * object per node, greatly reducing GC pressure after collection. The
+   * returned profile is identical to the default path. Cannot be combined
+   * with lineNumbers. This defaults to false.
+   */
+  flatTransfer?: boolean;
+
+  /**
+   * Samples whose script name contains this substring are dropped, along
+   * with their subtrees, within the native addon before any JS objects are
+   * created for them. Cannot be combined with lineNumbers,
+   * nativeSerialization, or flatTransfer.
+   */
+  ignoreSamplesPath?: string;
+
+  /**
+   * Subtrees whose total hit count is below this threshold are dropped
+   * within the native addon. Same restrictions as ignoreSamplesPath.
+   */
+  minHitCount?: number;
+
+  /**
+   * Caps the depth of translated stacks; frames below the cap have their
+   * hits folded into the frame at the cap, so sample totals are preserved.
+   * Cannot be combined with lineNumbers, ignoreSamplesPath, or minHitCount.
+   */
+  maxStackDepth?: number;
+
+  /**
+   * When set to true, GC pause time (measured within the native addon) and
+   * event-loop lag (measured by timer drift) are collected over the
+   * profiling window and emitted as additional sample types in the same
+   * profile, attached to "(garbage collector)" and "(event loop lag)"
+   * frames. Cannot be combined with nativeSerialization.
+   * This defaults to false.
+   */
+  collectStallMetrics?: boolean;
 }
 
+// With nativeSerialization the resolved value is the encoded profile as a
+// Buffer; every other configuration resolves to a profile object.
+export function profile(
+  options: TimeProfilerOptions & { nativeSerialization: true }
+): Promise<Buffer>;
+export function profile(
+  options: TimeProfilerOptions
+): Promise<perftools.profiles.IProfile>;
 export async function profile(options: TimeProfilerOptions) {
-  const stop = start(
-    options.intervalMicros || DEFAULT_INTERVAL_MICROS,
-    options.name,
-    options.sourceMapper,
-    options.lineNumbers
-  );
+  // The two start calls pick the matching start overload; options that
+  // conflict with nativeSerialization are rejected by start itself.
+  const stop = options.nativeSerialization
+    ? start(
+        options.intervalMicros || DEFAULT_INTERVAL_MICROS,
+        options.name,
+        options.sourceMapper,
+        options.lineNumbers,
+        true
+      )
+    : start(
+        options.intervalMicros || DEFAULT_INTERVAL_MICROS,
+        options.name,
+        options.sourceMapper,
+        options.lineNumbers,
+        false,
+        options.flatTransfer,
+        options.ignoreSamplesPath,
+        options.minHitCount,
+        options.maxStackDepth,
+        options.collectStallMetrics
+      );
   await delay(options.durationMillis);
   return stop();
 }
 
+// Overloaded on nativeSerialization so the returned stop function has the
+// precise result type: a profile object on the default path, the encoded
+// profile as a Buffer when the addon serializes it.
+export function start(
+  intervalMicros?: Microseconds,
+  name?: string,
+  sourceMapper?: SourceMapper,
+  lineNumbers?: boolean,
+  nativeSerialization?: false,
+  flatTransfer?: boolean,
+  ignoreSamplesPath?: string,
+  minHitCount?: number,
+  maxStackDepth?: number,
+  collectStallMetrics?: boolean
+): () => perftools.profiles.IProfile;
+export function start(
+  intervalMicros: Microseconds | undefined,
+  name: string | undefined,
+  sourceMapper: SourceMapper | undefined,
+  lineNumbers: boolean | undefined,
+  nativeSerialization: true
+): () => Buffer;
 export function start(
   intervalMicros: Microseconds = DEFAULT_INTERVAL_MICROS,
   name?: string,
   sourceMapper?: SourceMapper,
-  lineNumbers?: boolean
-) {
+  lineNumbers?: boolean,
+  nativeSerialization?: boolean,
+  flatTransfer?: boolean,
+  ignoreSamplesPath?: string,
+  minHitCount?: number,
+  maxStackDepth?: number,
+  collectStallMetrics?: boolean
+): () => perftools.profiles.IProfile | Buffer {
+  if (nativeSerialization && (sourceMapper || lineNumbers)) {
+    throw new Error(
+      'nativeSerialization cannot be used with sourceMapper or lineNumbers'
+    );
+  }
+  if (flatTransfer && lineNumbers) {
+    throw new Error('flatTransfer cannot be used with lineNumbers');
+  }
+  const nativeFiltering = ignoreSamplesPath !== undefined || minHitCount !== undefined;
+  if (nativeFiltering && (lineNumbers || nativeSerialization || flatTransfer)) {
+    throw new Error(
+      'ignoreSamplesPath and minHitCount cannot be used with lineNumbers, ' +
+        'nativeSerialization, or flatTransfer'
+    );
+  }
+  if (
+    maxStackDepth !== undefined &&
+    (lineNumbers || nativeSerialization || flatTransfer || nativeFiltering)
+  ) {
+    throw new Error(
+      'maxStackDepth cannot be used with lineNumbers, nativeSerialization, ' +
+        'flatTransfer, ignoreSamplesPath, or minHitCount'
+    );
+  }
+  if (collectStallMetrics && (nativeSerialization || flatTransfer)) {
+    throw new Error(
+      'collectStallMetrics cannot be used with nativeSerialization or ' +
+        'flatTransfer'
+    );
+  }
   if (profiling) {
     throw new Error('already profiling');
   }
@@ -83,16 +239,392 @@ export function start(
   (process as any)._startProfilerIdleNotifier();
   console.log('Starting profile collection');
   startProfiling(runName, lineNumbers);
-  return function stop() {
+  // Stall collection: GC pauses are bracketed within the addon; event-loop
+  // lag is measured as timer drift, the same signal the adaptive governor
+  // uses.
+  let lagTotalMicros = 0;
+  let lagTimer: NodeJS.Timer | undefined;
+  if (collectStallMetrics) {
+    startGcTracking();
+    let lastTick = Date.now();
+    lagTimer = setInterval(() => {
+      const now = Date.now();
+      lagTotalMicros +=
+        Math.max(0, now - lastTick - STALL_CHECK_PERIOD_MILLIS) * 1000;
+      lastTick = now;
+    }, STALL_CHECK_PERIOD_MILLIS);
+    lagTimer.unref();
+  }
+  return function stop(): perftools.profiles.IProfile | Buffer {
+    if (nativeSerialization) {
+      profiling = false;
+      console.log('Stopping profile collection');
+      const encoded = stopProfilingProto(runName, intervalMicros);
+      console.log('Stop reporting idle time to V8');
+      // tslint:disable-next-line no-any
+      (process as any)._stopProfilerIdleNotifier();
+      return encoded;
+    }
+    if (flatTransfer) {
+      profiling = false;
+      console.log('Stopping profile collection');
+      const flat = stopProfilingFlat(runName);
+      console.log('Stop reporting idle time to V8');
+      // tslint:disable-next-line no-any
+      (process as any)._stopProfilerIdleNotifier();
+      console.log('Serialize profile');
+      const flatProfile = serializeTimeProfileFlat(
+        flat,
+        intervalMicros,
+        sourceMapper
+      );
+      console.log('Finished profile serialization');
+      return flatProfile;
+    }
     profiling = false;
     console.log('Stopping profile collection');
-    const result = stopProfiling(runName, lineNumbers);
+    let result;
+    if (maxStackDepth !== undefined) {
+      result = stopProfiling(
+        runName,
+        lineNumbers,
+        undefined,
+        undefined,
+        maxStackDepth
+      );
+    } else if (nativeFiltering) {
+      result = stopProfiling(runName, lineNumbers, ignoreSamplesPath, minHitCount);
+    } else {
+      result = stopProfiling(runName, lineNumbers);
+    }
     console.log('Stop reporting idle time to V8');
     // tslint:disable-next-line no-any
     (process as any)._stopProfilerIdleNotifier();
+    let stallMetrics: StallMetrics | undefined;
+    if (collectStallMetrics) {
+      clearInterval(lagTimer!);
+      const gc = stopGcTracking();
+      stallMetrics = {
+        gcPauseMicros: gc.gcPauseMicros,
+        gcCount: gc.gcCount,
+        eventLoopLagMicros: lagTotalMicros,
+      };
+    }
     console.log('Serialize profile');
-    const profile = serializeTimeProfile(result, intervalMicros, sourceMapper);
+    const profile = serializeTimeProfile(
+      result,
+      intervalMicros,
+      sourceMapper,
+      stallMetrics
+    );
     console.log('Finished profile serialization');
     return profile;
   };
 }
+
+export interface AdaptiveTimeProfilerOptions {
+  /** finest sampling interval the governor may select. */
+  floorIntervalMicros?: Microseconds;
+  /** coarsest sampling interval the governor may select. */
+  ceilingIntervalMicros?: Microseconds;
+  /**
+   * event-loop lag above which the governor coarsens the sampling interval.
+   * Lag below a quarter of this threshold lets the interval tighten again.
+   */
+  lagThresholdMillis?: Milliseconds;
+  /** how often the governor inspects event-loop lag. */
+  checkPeriodMillis?: Milliseconds;
+  sourceMapper?: SourceMapper;
+}
+
+const DEFAULT_FLOOR_INTERVAL_MICROS: Microseconds = 500;
+const DEFAULT_CEILING_INTERVAL_MICROS: Microseconds = 8000;
+const DEFAULT_LAG_THRESHOLD_MILLIS: Milliseconds = 25;
+const DEFAULT_CHECK_PERIOD_MILLIS: Milliseconds = 1000;
+
+/**
+ * Starts time profiling under an adaptive sampling-interval governor. The
+ * governor watches event-loop lag and doubles the sampling interval (up to
+ * the ceiling) when the loop falls behind, halving it again (down to the
+ * floor) once the loop recovers. V8 only applies a new interval to a new
+ * profiler session, so each adjustment rotates to a fresh segment; segments
+ * are merged on stop with per-segment sample weights, so the resulting
+ * profile's wall-time values are correct regardless of how often the
+ * interval moved.
+ *
+ * @return a function which stops profiling and returns the merged profile.
+ */
+export function startAdaptive(options: AdaptiveTimeProfilerOptions = {}) {
+  const floorIntervalMicros =
+    options.floorIntervalMicros || DEFAULT_FLOOR_INTERVAL_MICROS;
+  const ceilingIntervalMicros =
+    options.ceilingIntervalMicros || DEFAULT_CEILING_INTERVAL_MICROS;
+  const lagThresholdMillis =
+    options.lagThresholdMillis || DEFAULT_LAG_THRESHOLD_MILLIS;
+  const checkPeriodMillis =
+    options.checkPeriodMillis || DEFAULT_CHECK_PERIOD_MILLIS;
+  if (floorIntervalMicros > ceilingIntervalMicros) {
+    throw new Error('floorIntervalMicros must not exceed ceilingIntervalMicros');
+  }
+  if (profiling) {
+    throw new Error('already profiling');
+  }
+
+  profiling = true;
+  const segments: WeightedTimeProfile[] = [];
+  let currentIntervalMicros = floorIntervalMicros;
+  let segmentIndex = 0;
+  const baseName = `pprof-adaptive-${Date.now()}-${Math.random()}`;
+  let runName = `${baseName}-${segmentIndex}`;
+
+  setSamplingInterval(currentIntervalMicros);
+  // tslint:disable-next-line no-any
+  (process as any)._startProfilerIdleNotifier();
+  startProfiling(runName);
+
+  // Rotates to a new profiler session so the adjusted interval takes effect.
+  // The next session is started before the current one is stopped so no
+  // samples are lost at the seam.
+  function rotate(newIntervalMicros: Microseconds) {
+    const previousName = runName;
+    const previousIntervalMicros = currentIntervalMicros;
+    currentIntervalMicros = newIntervalMicros;
+    segmentIndex++;
+    runName = `${baseName}-${segmentIndex}`;
+    setSamplingInterval(currentIntervalMicros);
+    startProfiling(runName);
+    segments.push({
+      profile: stopProfiling(previousName),
+      intervalMicros: previousIntervalMicros,
+    });
+  }
+
+  let lastTick = Date.now();
+  const governorTimer = setInterval(() => {
+    const now = Date.now();
+    const lagMillis = Math.max(0, now - lastTick - checkPeriodMillis);
+    lastTick = now;
+    if (
+      lagMillis > lagThresholdMillis &&
+      currentIntervalMicros < ceilingIntervalMicros
+    ) {
+      rotate(Math.min(ceilingIntervalMicros, currentIntervalMicros * 2));
+    } else if (
+      lagMillis < lagThresholdMillis / 4 &&
+      currentIntervalMicros > floorIntervalMicros
+    ) {
+      rotate(Math.max(floorIntervalMicros, currentIntervalMicros / 2));
+    }
+  }, checkPeriodMillis);
+  governorTimer.unref();
+
+  return function stop(): perftools.profiles.IProfile {
+    profiling = false;
+    clearInterval(governorTimer);
+    segments.push({
+      profile: stopProfiling(runName),
+      intervalMicros: currentIntervalMicros,
+    });
+    // tslint:disable-next-line no-any
+    (process as any)._stopProfilerIdleNotifier();
+    return serializeWeightedTimeProfiles(
+      segments,
+      floorIntervalMicros,
+      options.sourceMapper
+    );
+  };
+}
+
+/**
+ * Starts time profiling in shared-export mode: the returned stop function
+ * writes the profile, in the flat structure-of-arrays layout, into a
+ * memory-mapped file that a sidecar process consumes, and returns the
+ * number of bytes written. The serving process does only the native tree
+ * copy; serialization, compression, and upload run in the sidecar, outside
+ * this process's CPU budget, replacing in-process use of encode. The file's
+ * header carries a sequence counter so the sidecar can detect updates and
+ * torn reads. Not supported on Windows.
+ *
+ * @param filePath - path of the memory-mapped export file.
+ * @param intervalMicros - average time in microseconds between samples.
+ */
+export function startShared(
+  filePath: string,
+  intervalMicros: Microseconds = DEFAULT_INTERVAL_MICROS
+) {
+  if (profiling) {
+    throw new Error('already profiling');
+  }
+  profiling = true;
+  const runName = `pprof-shared-${Date.now()}-${Math.random()}`;
+  setSamplingInterval(intervalMicros);
+  // tslint:disable-next-line no-any
+  (process as any)._startProfilerIdleNotifier();
+  startProfiling(runName);
+  return function stop(): number {
+    profiling = false;
+    const bytes = stopProfilingShared(runName, filePath);
+    // tslint:disable-next-line no-any
+    (process as any)._stopProfilerIdleNotifier();
+    return bytes;
+  };
+}
+
+/**
+ * Starts time profiling in timestamped-samples mode: V8 records the raw
+ * sample stream alongside the aggregated tree, and the returned stop
+ * function yields both. Sample node ids and timestamps come back as typed
+ * arrays and nodes carry a nodeId, so samples can be joined to stacks and
+ * aligned with request traces to build time-sliced flame charts.
+ *
+ * @param intervalMicros - average time in microseconds between samples.
+ * @param maxSamples - optional cap on the raw sample stream recorded for
+ *   the session. The cap bounds the typed arrays returned here, not the
+ *   aggregated tree. Ignored on V8 versions without a per-session sample
+ *   limit (before 7.6).
+ */
+export function startTimestamped(
+  intervalMicros: Microseconds = DEFAULT_INTERVAL_MICROS,
+  maxSamples?: number
+) {
+  if (profiling) {
+    throw new Error('already profiling');
+  }
+  profiling = true;
+  const runName = `pprof-timestamped-${Date.now()}-${Math.random()}`;
+  setSamplingInterval(intervalMicros);
+  // tslint:disable-next-line no-any
+  (process as any)._startProfilerIdleNotifier();
+  startProfiling(runName, false, maxSamples || 0, true);
+  return function stop(): TimestampedTimeProfile {
+    profiling = false;
+    const result = stopProfilingTimestamped(runName);
+    // tslint:disable-next-line no-any
+    (process as any)._stopProfilerIdleNotifier();
+    return result;
+  };
+}
+
+// Registers/clears the label set attributed to samples collected while it is
+// current (timestamped mode only). Applications call setLabels at context
+// switches — e.g. from an AsyncLocalStorage-backed request middleware — and
+// the addon does the per-sample attribution by timestamp.
+export { setLabels, clearLabels } from './time-profiler-bindings';
+
+let aggregating = false;
+let aggregationCycle = 0;
+let aggregationBaseName = '';
+
+/**
+ * Starts aggregated profiling: profiler runs are folded cycle by cycle into
+ * one merged profile held within the native addon, so a collector can upload
+ * one combined profile per flush window (e.g. hourly) instead of one per
+ * cycle, without the intermediate cycles ever being materialized as JS
+ * objects or merged in JS.
+ *
+ * @param intervalMicros - average time in microseconds between samples.
+ */
+export function startAggregated(
+  intervalMicros: Microseconds = DEFAULT_INTERVAL_MICROS
+) {
+  if (profiling || aggregating) {
+    throw new Error('already profiling');
+  }
+  aggregating = true;
+  aggregationCycle = 0;
+  aggregationBaseName = `pprof-aggregated-${Date.now()}-${Math.random()}`;
+  setSamplingInterval(intervalMicros);
+  // tslint:disable-next-line no-any
+  (process as any)._startProfilerIdleNotifier();
+  startAggregation(intervalMicros);
+  startProfiling(`${aggregationBaseName}-${aggregationCycle}`);
+}
+
+/**
+ * Ends the current cycle, folding its samples into the merged profile, and
+ * starts the next cycle. The next run is started before the current one is
+ * stopped so no samples are lost at the seam.
+ */
+export function aggregateCycle() {
+  if (!aggregating) {
+    throw new Error('aggregated profiling is not started');
+  }
+  const previousName = `${aggregationBaseName}-${aggregationCycle}`;
+  aggregationCycle++;
+  startProfiling(`${aggregationBaseName}-${aggregationCycle}`);
+  aggregateProfile(previousName);
+}
+
+/**
+ * Emits the profile merged so far as an uncompressed profile.proto Buffer
+ * (pass it to encode() for upload) and resets the merge window. Profiling
+ * continues without interruption; the running cycle is not included.
+ */
+export function flushAggregated(): Buffer {
+  if (!aggregating) {
+    throw new Error('aggregated profiling is not started');
+  }
+  return flushAggregatedProfile();
+}
+
+/** Stops aggregated profiling, discarding samples not yet flushed. */
+export function stopAggregated() {
+  if (!aggregating) {
+    return;
+  }
+  aggregating = false;
+  aggregateProfile(`${aggregationBaseName}-${aggregationCycle}`);
+  stopAggregation();
+  // tslint:disable-next-line no-any
+  (process as any)._stopProfilerIdleNotifier();
+}
+
+let continuousProfiling = false;
+let continuousIntervalMicros: Microseconds = DEFAULT_INTERVAL_MICROS;
+
+/**
+ * Starts continuous profiling: one long-running profiler session whose
+ * samples are handed back incrementally by collectDelta, so steady-state
+ * overhead is just the sampling itself rather than repeated start/stop
+ * churn (and the code-map rebuild each start implies).
+ *
+ * @param intervalMicros - average time in microseconds between samples.
+ */
+export function startContinuous(
+  intervalMicros: Microseconds = DEFAULT_INTERVAL_MICROS
+) {
+  if (profiling || continuousProfiling) {
+    throw new Error('already profiling');
+  }
+  continuousProfiling = true;
+  continuousIntervalMicros = intervalMicros;
+  setSamplingInterval(intervalMicros);
+  // tslint:disable-next-line no-any
+  (process as any)._startProfilerIdleNotifier();
+  startContinuousProfiling();
+}
+
+/**
+ * Collects and serializes the samples accumulated since startContinuous or
+ * the previous collectDelta call. Profiling continues without interruption.
+ */
+export function collectDelta(
+  sourceMapper?: SourceMapper
+): perftools.profiles.IProfile {
+  if (!continuousProfiling) {
+    throw new Error('continuous profiling is not started');
+  }
+  const result = collectContinuousDelta();
+  return serializeTimeProfile(result, continuousIntervalMicros, sourceMapper);
+}
+
+/** Stops continuous profiling, discarding samples not yet collected. */
+export function stopContinuous() {
+  if (!continuousProfiling) {
+    return;
+  }
+  continuousProfiling = false;
+  stopContinuousProfiling();
+  // tslint:disable-next-line no-any
+  (process as any)._stopProfilerIdleNotifier();
+}
@@ -24,6 +24,27 @@ export interface TimeProfile {
   startTime: number;
 }
 
+/**
+ * Structure-of-arrays transfer format for a time profile. Each typed array
+ * has one entry per profile node, in pre-order; index 0 is the "(root)" node
+ * and parentIndex is -1 for the root. Function and script names are indices
+ * into stringTable.
+ */
+export interface FlatTimeProfile {
+  /** Time in nanoseconds at which profile was stopped. */
+  endTime: number;
+  /** Time in nanoseconds at which profile was started. */
+  startTime: number;
+  stringTable: string[];
+  nameIndex: Int32Array;
+  scriptNameIndex: Int32Array;
+  scriptId: Int32Array;
+  lineNumber: Int32Array;
+  columnNumber: Int32Array;
+  hitCount: Int32Array;
+  parentIndex: Int32Array;
+}
+
 export interface ProfileNode {
   // name is the function name.
   name?: string;
@@ -36,6 +57,29 @@ export interface ProfileNode {
 
 export interface TimeProfileNode extends ProfileNode {
   hitCount: number;
+  /** V8 node id; present only in timestamped-samples mode. */
+  nodeId?: number;
+}
+
+/**
+ * A time profile together with the raw sample stream recorded during it.
+ * The stream is transferred as parallel typed arrays (one entry per sample)
+ * rather than per-sample objects; nodeId on the profile's nodes keys them to
+ * sampleNodeIds.
+ */
+export interface TimestampedTimeProfile {
+  profile: TimeProfile;
+  sampleNodeIds: Int32Array;
+  /**
+   * Per-sample timestamps in microseconds since epoch, rebased at stop
+   * from V8's monotonic time base (which profile.startTime and
+   * profile.endTime remain on).
+   */
+  sampleTimestamps: Float64Array;
+  /** Per-sample index into labelSets; -1 for unlabeled samples. */
+  sampleLabelIndex: Int32Array;
+  /** Distinct label sets registered via setLabels during the session. */
+  labelSets: Array<{ [key: string]: string }>;
 }
 
 export interface AllocationProfileNode extends ProfileNode {
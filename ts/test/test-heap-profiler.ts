@@ -21,6 +21,7 @@ import * as v8HeapProfiler from '../src/heap-profiler-bindings';
 import { AllocationProfileNode } from '../src/v8-types';
 
 import {
+  heapProfile,
   heapProfileExcludePath,
   heapProfileIncludePath,
   heapProfileWithExternal,
@@ -181,4 +182,89 @@ describe('HeapProfiler', () => {
       );
     });
   });
+
+  describe('pause and resume', () => {
+    let pauseStub: sinon.SinonStub<[], void>;
+    let resumeStub: sinon.SinonStub<[], void>;
+    let deltaStub: sinon.SinonStub<[], AllocationProfileNode>;
+    beforeEach(() => {
+      pauseStub = sinon.stub(v8HeapProfiler, 'pauseSamplingHeapProfiler');
+      resumeStub = sinon.stub(v8HeapProfiler, 'resumeSamplingHeapProfiler');
+      deltaStub = sinon
+        .stub(v8HeapProfiler, 'getAllocationProfileDelta')
+        .returns(copy(v8HeapProfile));
+    });
+    afterEach(() => {
+      pauseStub.restore();
+      resumeStub.restore();
+      deltaStub.restore();
+    });
+
+    it('should throw error when not started', () => {
+      assert.throws(
+        () => {
+          heapProfiler.pause();
+        },
+        (err: Error) => {
+          return err.message === 'Heap profiler is not enabled.';
+        }
+      );
+    });
+
+    it('should throw error when collecting a delta while paused', () => {
+      heapProfiler.start(1024 * 512, 32);
+      heapProfiler.pause();
+      assert.ok(
+        pauseStub.called,
+        'expected pauseSamplingHeapProfiler to be called'
+      );
+      assert.throws(
+        () => {
+          heapProfiler.v8ProfileDelta();
+        },
+        (err: Error) => {
+          return err.message === 'Heap profiler is paused.';
+        }
+      );
+      assert.ok(
+        !deltaStub.called,
+        'expected getAllocationProfileDelta not to be called while paused'
+      );
+    });
+
+    it('should collect deltas again after resume', () => {
+      heapProfiler.start(1024 * 512, 32);
+      heapProfiler.pause();
+      heapProfiler.resume();
+      assert.ok(
+        resumeStub.called,
+        'expected resumeSamplingHeapProfiler to be called'
+      );
+      heapProfiler.v8ProfileDelta();
+      assert.ok(
+        deltaStub.called,
+        'expected getAllocationProfileDelta to be called after resume'
+      );
+    });
+
+    it('should report a full delta after a pause/resume cycle', () => {
+      heapProfiler.start(1024 * 512, 32);
+      heapProfiler.pause();
+      heapProfiler.resume();
+      const delta = heapProfiler.profileDelta();
+      assert.deepEqual(delta, heapProfile);
+    });
+
+    it('should clear the paused state on stop', () => {
+      heapProfiler.start(1024 * 512, 32);
+      heapProfiler.pause();
+      heapProfiler.stop();
+      heapProfiler.start(1024 * 512, 32);
+      heapProfiler.v8ProfileDelta();
+      assert.ok(
+        deltaStub.called,
+        'expected getAllocationProfileDelta to be called after restart'
+      );
+    });
+  });
 });
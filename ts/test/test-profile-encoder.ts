@@ -14,11 +14,13 @@
  * limitations under the License.
  */
 
+import { randomBytes } from 'crypto';
 import * as pify from 'pify';
+import { Writable } from 'stream';
 import { gunzip as gunzipPromise, gunzipSync } from 'zlib';
 
 import { perftools } from '../../proto/profile';
-import { encode, encodeSync } from '../src/profile-encoder';
+import { encode, encodeSync, encodeToStream } from '../src/profile-encoder';
 
 import { decodedTimeProfile, timeProfile } from './profiles-for-tests';
 
@@ -42,4 +44,93 @@ describe('profile-encoded', () => {
       assert.deepEqual(decoded, decodedTimeProfile);
     });
   });
+  describe('compression options', () => {
+    // zstd support depends on the Node runtime's zlib; match the encoder's
+    // own feature detection.
+    // tslint:disable-next-line no-any
+    const zlibWithZstd = require('zlib') as any;
+    const zstdSupported = typeof zlibWithZstd.zstdCompressSync === 'function';
+
+    it('should honor the gzip level option', () => {
+      const encoded = encodeSync(timeProfile, {
+        compression: 'gzip',
+        level: 9,
+      });
+      const unzipped = gunzipSync(encoded);
+      const decoded = perftools.profiles.Profile.decode(unzipped);
+      assert.deepEqual(decoded, decodedTimeProfile);
+    });
+
+    it('should produce zstd output when supported, and throw otherwise', async () => {
+      if (zstdSupported) {
+        const encoded = await encode(timeProfile, { compression: 'zstd' });
+        const decoded = perftools.profiles.Profile.decode(
+          zlibWithZstd.zstdDecompressSync(encoded)
+        );
+        assert.deepEqual(decoded, decodedTimeProfile);
+      } else {
+        assert.throws(
+          () => {
+            encodeSync(timeProfile, { compression: 'zstd' });
+          },
+          (err: Error) => {
+            return (
+              err.message ===
+              'zstd compression is not supported by this Node runtime; use gzip'
+            );
+          }
+        );
+      }
+    });
+  });
+  describe('encodeToStream', () => {
+    it('should stream an encoding identical to encode', async () => {
+      const chunks: Buffer[] = [];
+      const sink = new Writable({
+        write(chunk, encoding, callback) {
+          chunks.push(chunk as Buffer);
+          callback();
+        },
+      });
+      await encodeToStream(timeProfile, sink);
+      const unzipped = gunzipSync(Buffer.concat(chunks));
+      const decoded = perftools.profiles.Profile.decode(unzipped);
+      assert.deepEqual(decoded, decodedTimeProfile);
+    });
+    it('should reject rather than stall when the sink errors', async () => {
+      const sink = new Writable({
+        write(chunk, encoding, callback) {
+          callback(new Error('disk full'));
+        },
+      });
+      let error: Error | undefined;
+      try {
+        await encodeToStream(timeProfile, sink);
+      } catch (e) {
+        error = e;
+      }
+      assert.ok(error, 'expected encodeToStream to reject');
+      assert.strictEqual(error!.message, 'disk full');
+    });
+    it('should reject rather than stall when the sink errors while a write is waiting for drain', async () => {
+      // Incompressible input fills the gzip stream's buffer immediately, so
+      // a write parks on 'drain'; the sink then stalls its first chunk and
+      // errors, which must reject the parked write rather than hang.
+      const profile = randomBytes(4 * 1024 * 1024);
+      const sink = new Writable({
+        highWaterMark: 1,
+        write(chunk, encoding, callback) {
+          setTimeout(() => callback(new Error('disk full')), 20);
+        },
+      });
+      let error: Error | undefined;
+      try {
+        await encodeToStream(profile, sink);
+      } catch (e) {
+        error = e;
+      }
+      assert.ok(error, 'expected encodeToStream to reject');
+      assert.strictEqual(error!.message, 'disk full');
+    });
+  });
 });
@@ -17,10 +17,12 @@ import * as sinon from 'sinon';
 import * as tmp from 'tmp';
 
 import {
+  ProfileSerializer,
   serializeHeapProfile,
   serializeTimeProfile,
 } from '../src/profile-serializer';
 import { SourceMapper } from '../src/sourcemapper/sourcemapper';
+import { TimeProfile } from '../src/v8-types';
 
 import {
   anonymousFunctionHeapProfile,
@@ -62,6 +64,135 @@ describe('profile-serializer', () => {
       );
       assert.deepEqual(timeProfileOut, anonymousFunctionTimeProfile);
     });
+    it('should share one location between identical frames in different stacks', () => {
+      const leaf = {
+        name: 'hot',
+        scriptName: 'script1',
+        scriptId: 1,
+        lineNumber: 7,
+        columnNumber: 3,
+        hitCount: 1,
+        children: [],
+      };
+      const prof: TimeProfile = {
+        startTime: 0,
+        endTime: 10 * 1000 * 1000,
+        topDownRoot: {
+          name: '(root)',
+          scriptName: 'root',
+          scriptId: 0,
+          hitCount: 0,
+          children: [
+            {
+              name: 'parent1',
+              scriptName: 'script1',
+              scriptId: 1,
+              lineNumber: 1,
+              columnNumber: 1,
+              hitCount: 0,
+              children: [{ ...leaf, children: [] }],
+            },
+            {
+              name: 'parent2',
+              scriptName: 'script1',
+              scriptId: 1,
+              lineNumber: 2,
+              columnNumber: 1,
+              hitCount: 0,
+              children: [{ ...leaf, children: [] }],
+            },
+          ],
+        },
+      };
+      const out = serializeTimeProfile(prof, 1000);
+      assert.strictEqual(out.location!.length, 3);
+      assert.strictEqual(out.function!.length, 3);
+      assert.strictEqual(out.sample!.length, 2);
+      assert.strictEqual(
+        out.sample![0].locationId![0],
+        out.sample![1].locationId![0]
+      );
+    });
+    it('should keep frames distinct when only the column differs', () => {
+      // Columns more than 2^20 apart, as in a one-line minified bundle.
+      const prof: TimeProfile = {
+        startTime: 0,
+        endTime: 10 * 1000 * 1000,
+        topDownRoot: {
+          name: '(root)',
+          scriptName: 'root',
+          scriptId: 0,
+          hitCount: 0,
+          children: [
+            {
+              name: 'f',
+              scriptName: 'bundle.js',
+              scriptId: 1,
+              lineNumber: 1,
+              columnNumber: 10,
+              hitCount: 1,
+              children: [],
+            },
+            {
+              name: 'f',
+              scriptName: 'bundle.js',
+              scriptId: 1,
+              lineNumber: 1,
+              columnNumber: 10 + 2 * 1024 * 1024,
+              hitCount: 1,
+              children: [],
+            },
+          ],
+        },
+      };
+      const out = serializeTimeProfile(prof, 1000);
+      assert.strictEqual(out.function!.length, 1);
+      assert.strictEqual(out.location!.length, 2);
+      assert.notStrictEqual(
+        out.sample![0].locationId![0],
+        out.sample![1].locationId![0]
+      );
+    });
+  });
+
+  describe('stall metrics', () => {
+    it('should emit GC pause and event-loop lag as extra sample types', () => {
+      const out = serializeTimeProfile(v8TimeProfile, 1000, undefined, {
+        gcPauseMicros: 2500,
+        gcCount: 3,
+        eventLoopLagMicros: 800,
+      });
+      const strings = out.stringTable!;
+      assert.deepEqual(
+        out.sampleType!.map(valueType => strings[valueType.type as number]),
+        ['sample', 'wall', 'gcpause', 'eventlooplag']
+      );
+      for (const sample of out.sample!) {
+        assert.strictEqual(sample.value!.length, 4);
+      }
+      const gcSample = out.sample!.find(sample => sample.value![2] === 2500);
+      assert.ok(gcSample, 'expected a sample carrying the GC pause total');
+      assert.deepEqual(gcSample!.value, [0, 0, 2500, 0]);
+      const lagSample = out.sample!.find(sample => sample.value![3] === 800);
+      assert.ok(lagSample, 'expected a sample carrying the event-loop lag');
+      assert.deepEqual(lagSample!.value, [0, 0, 0, 800]);
+      assert.ok(strings.indexOf('(garbage collector)') !== -1);
+      assert.ok(strings.indexOf('(event loop lag)') !== -1);
+    });
+    it('should pad tree samples with zero stall values', () => {
+      const out = serializeTimeProfile(v8TimeProfile, 1000, undefined, {
+        gcPauseMicros: 0,
+        gcCount: 0,
+        eventLoopLagMicros: 0,
+      });
+      const treeSamples = out.sample!.slice(0, out.sample!.length - 2);
+      assert.strictEqual(treeSamples.length, timeProfile.sample!.length);
+      treeSamples.forEach((sample, i) => {
+        const expected = timeProfile.sample![i];
+        assert.deepEqual(sample.locationId, expected.locationId);
+        assert.deepEqual(sample.value, [...(expected.value as number[]), 0, 0]);
+      });
+    });
   });
 
   describe('serializeHeapProfile', () => {
@@ -79,6 +210,35 @@ describe('profile-serializer', () => {
     });
   });
 
+  describe('ProfileSerializer', () => {
+    it('should match the one-shot serializer on its first cycle', () => {
+      const serializer = new ProfileSerializer();
+      const out = serializer.serializeTimeProfile(v8TimeProfile, 1000);
+      assert.deepEqual(out, timeProfile);
+    });
+    it('should reset samples but retain tables across cycles', () => {
+      const serializer = new ProfileSerializer();
+      const first = serializer.serializeTimeProfile(v8TimeProfile, 1000);
+      const second = serializer.serializeTimeProfile(v8TimeProfile, 1000);
+      assert.deepEqual(second, first);
+    });
+    it('should accumulate tables across differing profiles', () => {
+      const serializer = new ProfileSerializer();
+      serializer.serializeTimeProfile(v8TimeProfile, 1000);
+      const out = serializer.serializeTimeProfile(
+        v8AnonymousFunctionTimeProfile,
+        1000
+      );
+      assert.strictEqual(
+        out.sample!.length,
+        anonymousFunctionTimeProfile.sample!.length
+      );
+      // Strings from the first cycle remain in the shared table.
+      assert.ok(out.stringTable!.indexOf('script1') !== -1);
+      assert.ok(out.stringTable!.indexOf('(anonymous)') !== -1);
+    });
+  });
+
   describe('source map specified', () => {
     let sourceMapper: SourceMapper;
     before(async () => {
@@ -0,0 +1,190 @@
+/**
+ * Copyright 2019 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+import * as fs from 'fs';
+import * as path from 'path';
+import * as sinon from 'sinon';
+import { SourceMapGenerator } from 'source-map';
+import * as tmp from 'tmp';
+
+import { SourceMapper } from '../src/sourcemapper/sourcemapper';
+
+const assert = require('assert');
+
+const mapDir = tmp.dirSync();
+const mapDirPath = mapDir.name;
+
+const mapFoo = new SourceMapGenerator({ file: 'foo.js' });
+mapFoo.addMapping({
+  source: path.join(mapDirPath, 'foo.ts'),
+  name: 'foo1',
+  generated: { line: 1, column: 3 },
+  original: { line: 10, column: 0 },
+});
+fs.writeFileSync(path.join(mapDirPath, 'foo.js.map'), mapFoo.toString());
+
+// A bundler-style map whose "file" attribute (a hashed output name) differs
+// from the map file's own name.
+const mapBundle = new SourceMapGenerator({ file: 'app.3f2a1c.js' });
+mapBundle.addMapping({
+  source: path.join(mapDirPath, 'app.ts'),
+  name: 'handler',
+  generated: { line: 2, column: 4 },
+  original: { line: 7, column: 2 },
+});
+fs.writeFileSync(path.join(mapDirPath, 'bundle.js.map'), mapBundle.toString());
+
+const fooGeneratedPath = path.join(mapDirPath, 'foo.js');
+const fooLocation = { file: fooGeneratedPath, line: 1, column: 3 };
+const fooMappedLocation = {
+  file: path.join(mapDirPath, 'foo.ts'),
+  line: 10,
+  name: 'foo1',
+  column: undefined,
+};
+
+describe('SourceMapper', () => {
+  describe('create with a persistent index', () => {
+    it('should write the index file after a scan', async () => {
+      const indexPath = path.join(tmp.dirSync().name, 'sourcemap-index.json');
+      await SourceMapper.create([mapDirPath], indexPath);
+      assert.ok(fs.existsSync(indexPath), 'expected index file to be written');
+    });
+
+    it('should produce the same mappings on a warm start from the index', async () => {
+      const indexPath = path.join(tmp.dirSync().name, 'sourcemap-index.json');
+      const cold = await SourceMapper.create([mapDirPath], indexPath);
+      const warm = await SourceMapper.create([mapDirPath], indexPath);
+      assert.deepEqual(
+        warm.mappingInfo(fooLocation),
+        cold.mappingInfo(fooLocation)
+      );
+      assert.deepEqual(warm.mappingInfo(fooLocation), fooMappedLocation);
+    });
+
+    it('should fall back to a scan when an indexed map has changed', async () => {
+      const dir = tmp.dirSync().name;
+      const mapBar = new SourceMapGenerator({ file: 'bar.js' });
+      mapBar.addMapping({
+        source: path.join(dir, 'bar.ts'),
+        name: 'bar1',
+        generated: { line: 2, column: 1 },
+        original: { line: 4, column: 0 },
+      });
+      fs.writeFileSync(path.join(dir, 'bar.js.map'), mapBar.toString());
+      const indexPath = path.join(dir, 'sourcemap-index.json');
+      await SourceMapper.create([dir], indexPath);
+      // Invalidate the index by changing the map file's mtime.
+      const changed = new Date(2000, 0, 1);
+      fs.utimesSync(path.join(dir, 'bar.js.map'), changed, changed);
+      const mapper = await SourceMapper.create([dir], indexPath);
+      assert.deepEqual(
+        mapper.mappingInfo({
+          file: path.join(dir, 'bar.js'),
+          line: 2,
+          column: 1,
+        }),
+        {
+          file: path.join(dir, 'bar.ts'),
+          line: 4,
+          name: 'bar1',
+          column: undefined,
+        }
+      );
+    });
+  });
+
+  describe('lazy parsing', () => {
+    it('should key lazily indexed maps by the map "file" attribute', async () => {
+      const mapper = await SourceMapper.create([mapDirPath], undefined, true);
+      const generatedPath = path.join(mapDirPath, 'app.3f2a1c.js');
+      assert.ok(
+        mapper.hasMappingInfo(generatedPath),
+        'expected mapping info for the name in the map "file" attribute'
+      );
+      assert.ok(
+        !mapper.hasMappingInfo(path.join(mapDirPath, 'bundle.js')),
+        'expected no mapping info under the map file name'
+      );
+      await mapper.ensureLoaded([generatedPath]);
+      assert.deepEqual(
+        mapper.mappingInfo({ file: generatedPath, line: 2, column: 4 }),
+        {
+          file: path.join(mapDirPath, 'app.ts'),
+          line: 7,
+          name: 'handler',
+          column: 2,
+        }
+      );
+    });
+
+    it('should evict the least recently used consumer at the cache bound', async () => {
+      const mapper = await SourceMapper.create([mapDirPath], undefined, true);
+      // tslint:disable-next-line: no-any
+      (mapper as any).consumerCacheSize = 1;
+      const appGeneratedPath = path.join(mapDirPath, 'app.3f2a1c.js');
+      await mapper.ensureLoaded([fooGeneratedPath]);
+      assert.notStrictEqual(
+        mapper.infoMap.get(fooGeneratedPath)!.mapConsumer,
+        null,
+        'expected consumer to be parsed by ensureLoaded'
+      );
+      await mapper.ensureLoaded([appGeneratedPath]);
+      assert.strictEqual(
+        mapper.infoMap.get(fooGeneratedPath)!.mapConsumer,
+        null,
+        'expected least recently used consumer to be evicted'
+      );
+      assert.notStrictEqual(
+        mapper.infoMap.get(appGeneratedPath)!.mapConsumer,
+        null
+      );
+    });
+  });
+
+  describe('mapping memoization', () => {
+    it('should consult the consumer once per distinct location', async () => {
+      const mapper = await SourceMapper.create([mapDirPath]);
+      const entry = mapper.infoMap.get(fooGeneratedPath)!;
+      const spy = sinon.spy(
+        // tslint:disable-next-line: no-any
+        entry.mapConsumer as any,
+        'originalPositionFor'
+      );
+      const first = mapper.mappingInfo(fooLocation);
+      const second = mapper.mappingInfo(fooLocation);
+      assert.strictEqual(spy.callCount, 1);
+      assert.deepEqual(second, first);
+      spy.restore();
+    });
+
+    it('should keep serving mapped locations after the consumer is evicted', async () => {
+      const mapper = await SourceMapper.create([mapDirPath], undefined, true);
+      // tslint:disable-next-line: no-any
+      (mapper as any).consumerCacheSize = 1;
+      await mapper.ensureLoaded([fooGeneratedPath]);
+      const mapped = mapper.mappingInfo(fooLocation);
+      assert.deepEqual(mapped, fooMappedLocation);
+      // Loading a second map evicts foo's consumer.
+      await mapper.ensureLoaded([path.join(mapDirPath, 'app.3f2a1c.js')]);
+      assert.strictEqual(
+        mapper.infoMap.get(fooGeneratedPath)!.mapConsumer,
+        null
+      );
+      assert.deepEqual(mapper.mappingInfo(fooLocation), mapped);
+    });
+  });
+});